@@ -0,0 +1,591 @@
+// Benchmarks for hackertyper. The program source is compiled in with its
+// main() left out, so the numbers come from exactly the code that ships.
+// Every benchmark prints one JSON object per line.
+#define HACKERTYPER_NO_MAIN
+#include "hackertyper_cross.cpp"
+
+#include <sys/wait.h>
+
+double secondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Function to load the corpora named on the command line, or the embedded pack
+bool loadBenchCorpora(const std::vector<std::string>& files, std::vector<std::unique_ptr<Corpus>>& storage,
+                      std::vector<std::string_view>& corpora) {
+    for (const auto& file : files) {
+        storage.emplace_back(new Corpus());
+        if (!storage.back()->load(file)) return false;
+        corpora.push_back(storage.back()->text);
+    }
+    if (files.empty()) {
+        CorpusPack pack;
+        if (!openPack(std::string_view(reinterpret_cast<const char*>(embeddedPack), embeddedPackSize), pack)) {
+            return false;
+        }
+        for (uint32_t k = 0; k < pack.count; k++) {
+            corpora.push_back(pack.text(k));
+        }
+    }
+    return !corpora.empty();
+}
+
+// Value at fraction p of an ascending list
+double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) return 0;
+    return sorted[std::min(sorted.size() - 1, (size_t)(p * sorted.size()))];
+}
+
+// Where rendered frames go: nowhere, a pipe drained by a reader thread so
+// the cost of a real consumer on the other end is included, or the
+// in-memory terminal so the cost of interpreting the escapes is included
+struct BenchSink {
+    std::string kind = "null";
+    NullSink null;
+    TtySink pipeSink;
+    VtScreen vt;
+    int readFd = -1;
+    std::thread drain;
+
+    bool open(const std::string& sinkKind, int rows = 24, int cols = 80) {
+        kind = sinkKind;
+        if (kind == "null") {
+            out.sink = &null;
+            return true;
+        }
+        if (kind == "pipe") {
+            int fds[2];
+            if (pipe(fds) != 0) return false;
+            readFd = fds[0];
+            pipeSink.fd = fds[1];
+            out.sink = &pipeSink;
+            drain = std::thread([this]() {
+                char buffer[65536];
+                while (read(readFd, buffer, sizeof(buffer)) > 0) {}
+            });
+            return true;
+        }
+        if (kind == "vt") {
+            vtResize(vt, rows, cols);
+            out.sink = &vt;
+            return true;
+        }
+        return false;
+    }
+
+    void close() {
+        out.sink = &ttySink;
+        if (kind == "pipe") ::close(pipeSink.fd);
+        if (drain.joinable()) drain.join();
+        if (readFd >= 0) ::close(readFd);
+        readFd = -1;
+    }
+};
+
+// Function to zero the frame counters between runs
+void resetFrameStats() {
+    out.frames = 0;
+    out.syscalls = 0;
+    out.bytes = 0;
+    out.maxFrameSyscalls = 0;
+    out.maxFrameBytes = 0;
+}
+
+// Function to write a corpus of the given size by repeating the embedded texts
+bool writeBenchCorpus(const std::string& path, size_t bytes) {
+    std::vector<std::unique_ptr<Corpus>> storage;
+    std::vector<std::string_view> corpora;
+    if (!loadBenchCorpora({}, storage, corpora)) return false;
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    size_t written = 0;
+    for (size_t k = 0; written < bytes && file; k++) {
+        std::string_view text = corpora[k % corpora.size()];
+        size_t n = std::min(text.size(), bytes - written);
+        file.write(text.data(), n);
+        written += n;
+    }
+    return written == bytes && file.good();
+}
+
+// Markov generator: model build time and generated MB/s
+int benchGenerator(int argc, char* argv[]) {
+    int order = 5;
+    double megabytes = 64;
+    std::vector<std::string> files;
+    for (int a = 0; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--order" && a + 1 < argc) {
+            order = std::atoi(argv[++a]);
+        } else if (arg == "--mb" && a + 1 < argc) {
+            megabytes = std::atof(argv[++a]);
+        } else {
+            files.push_back(arg);
+        }
+    }
+
+    std::vector<std::unique_ptr<Corpus>> storage;
+    std::vector<std::string_view> corpora;
+    if (!loadBenchCorpora(files, storage, corpora)) {
+        std::cerr << "Error: cannot load corpora." << std::endl;
+        return 1;
+    }
+    size_t corpusBytes = 0;
+    for (std::string_view text : corpora) corpusBytes += text.size();
+
+    auto start = std::chrono::steady_clock::now();
+    MarkovModel model;
+    if (!buildMarkovModel(corpora, order, model)) {
+        std::cerr << "Error: not enough text to train the generator." << std::endl;
+        return 1;
+    }
+    double buildSeconds = secondsSince(start);
+
+    size_t contexts = 0;
+    for (uint32_t count : model.slotCount) contexts += count != 0;
+
+    // Pull text through the same interface the typing loop uses
+    GeneratorSource generator(model, 42);
+    size_t target = megabytes * 1024 * 1024;
+    size_t generated = 0;
+    unsigned checksum = 0;
+    start = std::chrono::steady_clock::now();
+    while (generated < target) {
+        size_t wanted = target - generated;
+        std::string_view chunk = generator.next(wanted);
+        checksum += (unsigned char)chunk.back();
+        generated += chunk.size();
+    }
+    double generateSeconds = secondsSince(start);
+
+    std::cout << "{\"bench\":\"generator\",\"order\":" << model.order
+              << ",\"corpus_bytes\":" << corpusBytes
+              << ",\"contexts\":" << contexts
+              << ",\"transitions\":" << model.nextChar.size()
+              << ",\"build_ms\":" << buildSeconds * 1000
+              << ",\"generated_mb\":" << generated / (1024.0 * 1024.0)
+              << ",\"mb_per_s\":" << generated / (1024.0 * 1024.0) / generateSeconds
+              << ",\"checksum\":" << checksum << "}" << std::endl;
+    return 0;
+}
+
+// Typing loop: startup time, per-keystroke latency (reveal plus the frame
+// write), bytes per frame and frames per second, for corpora of growing size
+int benchKeystroke(int argc, char* argv[]) {
+    int rows = 24, cols = 80, keys = 20000, charsToAdd = 5;
+    // The full 1 GB corpus run is opt-in: keystroke --max-mb 1024
+    double maxMegabytes = 32;
+    bool highlight = false;
+    std::string sinkKind = "null", dir = "/tmp";
+    for (int a = 0; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--highlight") highlight = true;
+        else if (a + 1 >= argc) break;
+        else if (arg == "--rows") rows = std::atoi(argv[++a]);
+        else if (arg == "--cols") cols = std::atoi(argv[++a]);
+        else if (arg == "--keys") keys = std::atoi(argv[++a]);
+        else if (arg == "--chars") charsToAdd = std::atoi(argv[++a]);
+        else if (arg == "--max-mb") maxMegabytes = std::atof(argv[++a]);
+        else if (arg == "--sink") sinkKind = argv[++a];
+        else if (arg == "--dir") dir = argv[++a];
+    }
+
+    for (size_t size = 1024; size <= maxMegabytes * 1024 * 1024; size *= 32) {
+        std::string path = dir + "/hackertyper_bench_" + std::to_string(size) + ".txt";
+        if (!writeBenchCorpus(path, size)) {
+            std::cerr << "Error: cannot write " << path << std::endl;
+            return 1;
+        }
+
+        BenchSink sink;
+        if (!sink.open(sinkKind, rows, cols)) {
+            std::cerr << "Error: unknown or unusable sink " << sinkKind << std::endl;
+            return 1;
+        }
+        resetFrameStats();
+
+        // Startup as main() does it: load the corpus, first full frame
+        auto start = std::chrono::steady_clock::now();
+        Corpus corpus;
+        corpus.load(path);
+        CorpusSource source;
+        source.text = corpus.text;
+        ScrollbackRing ring;
+        ring.resize(rows + 1000);
+        screenResize(screen, rows, cols);
+        redrawTypingView(ring, rows, cols);
+        presentFrame();
+        double startupMs = secondsSince(start) * 1000;
+
+        // One frame per key, the worst case for the frame cap
+        Highlighter highlighter;
+        std::vector<double> latencyUs;
+        latencyUs.reserve(keys);
+        unsigned long framesBefore = out.frames;
+        unsigned long long bytesBefore = out.bytes;
+        start = std::chrono::steady_clock::now();
+        for (int k = 0; k < keys; k++) {
+            auto keyStart = std::chrono::steady_clock::now();
+            revealForKey(source, charsToAdd, ring, highlight ? &highlighter : nullptr, true);
+            presentFrame();
+            latencyUs.push_back(secondsSince(keyStart) * 1e6);
+        }
+        double seconds = secondsSince(start);
+        unsigned long frames = out.frames - framesBefore;
+        sink.close();
+        unlink(path.c_str());
+
+        std::sort(latencyUs.begin(), latencyUs.end());
+        std::cout << "{\"bench\":\"keystroke\",\"corpus_bytes\":" << size
+                  << ",\"sink\":\"" << sinkKind << "\""
+                  << ",\"highlight\":" << (highlight ? "true" : "false")
+                  << ",\"startup_ms\":" << startupMs
+                  << ",\"keys\":" << keys
+                  << ",\"latency_us_p50\":" << percentile(latencyUs, 0.50)
+                  << ",\"latency_us_p90\":" << percentile(latencyUs, 0.90)
+                  << ",\"latency_us_p99\":" << percentile(latencyUs, 0.99)
+                  << ",\"latency_us_max\":" << latencyUs.back()
+                  << ",\"bytes_per_frame\":" << (out.bytes - bytesBefore) / std::max(1UL, frames)
+                  << ",\"fps\":" << frames / seconds << "}" << std::endl;
+    }
+    return 0;
+}
+
+// Full redraw path (--redraw): displayText() over a full scrollback every frame
+int benchDisplay(int argc, char* argv[]) {
+    int rows = 24, cols = 80, frames = 2000;
+    std::string sinkKind = "null";
+    for (int a = 0; a + 1 < argc; a += 2) {
+        std::string arg = argv[a];
+        if (arg == "--rows") rows = std::atoi(argv[a + 1]);
+        else if (arg == "--cols") cols = std::atoi(argv[a + 1]);
+        else if (arg == "--frames") frames = std::atoi(argv[a + 1]);
+        else if (arg == "--sink") sinkKind = argv[a + 1];
+    }
+
+    std::vector<std::unique_ptr<Corpus>> storage;
+    std::vector<std::string_view> corpora;
+    if (!loadBenchCorpora({}, storage, corpora)) return 1;
+    CorpusSource source;
+    source.text = corpora[0];
+    ScrollbackRing ring;
+    ring.resize(rows + 1000);
+    while (ring.count < ring.lines.size()) {
+        revealForKey(source, 4096, ring, nullptr, false);
+    }
+
+    BenchSink sink;
+    if (!sink.open(sinkKind, rows, cols)) return 1;
+    resetFrameStats();
+    screenResize(screen, rows, cols);
+
+    std::vector<double> frameMs;
+    auto start = std::chrono::steady_clock::now();
+    for (int k = 0; k < frames; k++) {
+        auto frameStart = std::chrono::steady_clock::now();
+        clearScreen();
+        showTypingHeader();
+        displayText(ring, rows - kTypingHeaderRows, cols);
+        setGrayText();
+        term << "_" << "\n";
+        presentFrame();
+        frameMs.push_back(secondsSince(frameStart) * 1000);
+    }
+    double seconds = secondsSince(start);
+    sink.close();
+
+    std::sort(frameMs.begin(), frameMs.end());
+    std::cout << "{\"bench\":\"display\",\"rows\":" << rows << ",\"cols\":" << cols
+              << ",\"sink\":\"" << sinkKind << "\""
+              << ",\"scrollback_lines\":" << ring.count
+              << ",\"frame_ms_p50\":" << percentile(frameMs, 0.50)
+              << ",\"frame_ms_p99\":" << percentile(frameMs, 0.99)
+              << ",\"bytes_per_frame\":" << out.bytes / std::max(1UL, out.frames)
+              << ",\"fps\":" << frames / seconds << "}" << std::endl;
+    return 0;
+}
+
+// Function to repaint the whole grid from scratch into a terminal model:
+// the reference that the incremental output must match
+void renderReference(VtScreen& vt) {
+    Screen reference = screen;
+    reference.repaint = true;
+    std::fill(reference.dirty.begin(), reference.dirty.end(), 1);
+    OutputSink* sink = out.sink;
+    std::swap(screen, reference);
+    out.sink = &vt;
+    vtResize(vt, screen.rows, screen.cols);
+    presentFrame();
+    std::swap(screen, reference);
+    out.sink = sink;
+}
+
+// Renderer check: the typing view is drawn the way main() draws it
+// (appends, grid diffs, forwarded scrolls, a resize half way) into one
+// terminal model, and the same grid is repainted from scratch into another
+// after every frame. Both terminals must show identical cells, colours
+// and styles.
+int benchVerify(int argc, char* argv[]) {
+    int keys = 3000;
+    std::vector<std::string> files;
+    for (int a = 0; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--keys" && a + 1 < argc) keys = std::atoi(argv[++a]);
+        else files.push_back(arg);
+    }
+
+    std::vector<std::unique_ptr<Corpus>> storage;
+    std::vector<std::string_view> corpora;
+    if (!loadBenchCorpora(files, storage, corpora)) return 1;
+
+    const int sizes[][4] = { { 24, 80, 30, 100 }, { 50, 132, 20, 40 }, { 8, 20, 12, 33 } };
+    int failures = 0;
+    for (const auto& size : sizes) {
+        for (bool highlight : { false, true }) {
+            int rows = size[0], cols = size[1];
+            CorpusSource source;
+            source.text = corpora[0];
+            ScrollbackRing ring;
+            ring.resize(rows + 1000);
+            Highlighter highlighter;
+            std::mt19937 batches(12345);
+
+            VtScreen shown, expected;
+            vtResize(shown, rows, cols);
+            out.sink = &shown;
+            screenResize(screen, rows, cols);
+            redrawTypingView(ring, rows, cols);
+            presentFrame();
+
+            int frames = 0, mismatched = 0, firstFrame = -1, firstRow = 0, firstCol = 0;
+            for (int k = 0; k < keys; k++) {
+                if (k == keys / 2) {
+                    // Resize as main() does: new grid, full redraw
+                    rows = size[2];
+                    cols = size[3];
+                    ring.resize(rows + 1000);
+                    vtResize(shown, rows, cols);
+                    screenResize(screen, rows, cols);
+                    redrawTypingView(ring, rows, cols);
+                }
+                revealForKey(source, 1 + batches() % 40, ring, highlight ? &highlighter : nullptr, true);
+
+                // Several keys may land in one frame
+                if (batches() % 3 != 0) continue;
+                presentFrame();
+                renderReference(expected);
+                frames++;
+                int row, col;
+                if (vtFirstDifference(shown, expected, row, col)) {
+                    if (mismatched++ == 0) {
+                        firstFrame = frames;
+                        firstRow = row;
+                        firstCol = col;
+                    }
+                }
+            }
+            out.sink = &ttySink;
+            if (mismatched > 0) failures++;
+
+            std::cout << "{\"bench\":\"verify\",\"rows\":" << size[0] << ",\"cols\":" << size[1]
+                      << ",\"resized_rows\":" << rows << ",\"resized_cols\":" << cols
+                      << ",\"highlight\":" << (highlight ? "true" : "false")
+                      << ",\"frames\":" << frames
+                      << ",\"mismatched_frames\":" << mismatched;
+            if (mismatched > 0) {
+                std::cout << ",\"first_mismatch\":{\"frame\":" << firstFrame << ",\"row\":" << firstRow
+                          << ",\"col\":" << firstCol << "}";
+            }
+            std::cout << "}" << std::endl;
+        }
+    }
+    return failures > 0;
+}
+
+// Matrix rain: frame build time and output bytes per frame on a large screen
+int benchRain(int argc, char* argv[]) {
+    int rows = 200, cols = 500, frames = 600;
+    std::string sinkKind = "null";
+    for (int a = 0; a + 1 < argc; a += 2) {
+        std::string arg = argv[a];
+        if (arg == "--rows") rows = std::atoi(argv[a + 1]);
+        else if (arg == "--cols") cols = std::atoi(argv[a + 1]);
+        else if (arg == "--frames") frames = std::atoi(argv[a + 1]);
+        else if (arg == "--sink") sinkKind = argv[a + 1];
+    }
+
+    // Frames go through the real grid and frame buffer into the sink
+    BenchSink sink;
+    if (!sink.open(sinkKind, rows, cols)) return 1;
+    resetFrameStats();
+    screenResize(screen, rows, cols);
+
+    MatrixRain rain(frames * MatrixRain::kFrameMs);
+    rain.budgetMs = 1e9;  // Measure the full cost of every frame
+    std::vector<double> frameMs;
+    auto start = std::chrono::steady_clock::now();
+    for (int k = 0; k < frames; k++) {
+        auto frameStart = std::chrono::steady_clock::now();
+        rain.step();
+        presentFrame();
+        frameMs.push_back(secondsSince(frameStart) * 1000);
+    }
+    double seconds = secondsSince(start);
+    sink.close();
+
+    std::sort(frameMs.begin(), frameMs.end());
+    std::cout << "{\"bench\":\"rain\",\"rows\":" << rows << ",\"cols\":" << cols
+              << ",\"sink\":\"" << sinkKind << "\""
+              << ",\"frames\":" << frames
+              << ",\"frame_ms_p50\":" << percentile(frameMs, 0.50)
+              << ",\"frame_ms_p99\":" << percentile(frameMs, 0.99)
+              << ",\"bytes_per_frame\":" << out.bytes / std::max(1UL, out.frames)
+              << ",\"max_fps\":" << frames / seconds << "}" << std::endl;
+    return 0;
+}
+
+// Server mode: throughput and memory per session with many clients typing.
+// The server runs in a child process on a Unix socket; every round sends one
+// key to each client and waits for each reply to end with the cursor.
+int benchServe(int argc, char* argv[]) {
+    int sessions = 1000, rounds = 100;
+    for (int a = 0; a + 1 < argc; a += 2) {
+        std::string arg = argv[a];
+        if (arg == "--sessions") sessions = std::atoi(argv[a + 1]);
+        else if (arg == "--rounds") rounds = std::atoi(argv[a + 1]);
+    }
+
+    std::vector<std::unique_ptr<Corpus>> storage;
+    std::vector<std::string_view> corpora;
+    if (!loadBenchCorpora({}, storage, corpora)) return 1;
+
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    std::string path = "/tmp/hackertyper_bench_" + std::to_string(getpid()) + ".sock";
+    pid_t child = fork();
+    if (child == 0) {
+        Server server;
+        server.text = corpora[0];
+        if (!openServer(server, path)) _exit(1);
+        runServer(server);
+        _exit(0);
+    }
+
+    // Resident memory of the server process
+    auto serverResident = [child]() -> size_t {
+        std::ifstream statm("/proc/" + std::to_string(child) + "/statm");
+        size_t size = 0, resident = 0;
+        statm >> size >> resident;
+        return resident * sysconf(_SC_PAGESIZE);
+    };
+
+    // Function to read until the reply ends with the parked cursor
+    auto awaitCursor = [](int fd) -> bool {
+        char buffer[65536];
+        std::string tail;
+        while (true) {
+            ssize_t n = read(fd, buffer, sizeof(buffer));
+            if (n <= 0) return false;
+            tail.append(buffer, n);
+            if (tail.size() >= 2 && tail.compare(tail.size() - 2, 2, "_\b") == 0) return true;
+            if (tail.size() > 2) tail.erase(0, tail.size() - 2);
+        }
+    };
+
+    struct sockaddr_un addr = {};
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+    size_t residentBefore = 0;
+    std::vector<int> clients;
+    for (int k = 0; k < sessions; k++) {
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        for (int attempt = 0; connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0; attempt++) {
+            if (attempt > 200) {
+                std::cerr << "Error: cannot connect to the server" << std::endl;
+                kill(child, SIGTERM);
+                return 1;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        if (k == 0) {
+            awaitCursor(fd);
+            residentBefore = serverResident();
+        } else if (!awaitCursor(fd)) {
+            break;
+        }
+        clients.push_back(fd);
+    }
+
+    std::vector<double> roundMs;
+    auto start = std::chrono::steady_clock::now();
+    for (int round = 0; round < rounds; round++) {
+        auto roundStart = std::chrono::steady_clock::now();
+        for (int fd : clients) {
+            if (write(fd, "a", 1) != 1) break;
+        }
+        for (int fd : clients) {
+            awaitCursor(fd);
+        }
+        roundMs.push_back(secondsSince(roundStart) * 1000);
+    }
+    double seconds = secondsSince(start);
+    size_t residentAfter = serverResident();
+
+    for (int fd : clients) close(fd);
+    kill(child, SIGTERM);
+    waitpid(child, nullptr, 0);
+
+    std::sort(roundMs.begin(), roundMs.end());
+    size_t keys = (size_t)clients.size() * rounds;
+    std::cout << "{\"bench\":\"serve\",\"sessions\":" << clients.size()
+              << ",\"rounds\":" << rounds
+              << ",\"keys_per_s\":" << keys / seconds
+              << ",\"round_ms_p50\":" << percentile(roundMs, 0.50)
+              << ",\"round_ms_p99\":" << percentile(roundMs, 0.99)
+              << ",\"server_rss_kb\":" << residentAfter / 1024
+              << ",\"bytes_per_session\":" << (residentAfter - residentBefore) / std::max<size_t>(1, clients.size() - 1)
+              << "}" << std::endl;
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    std::string which = argc > 1 ? argv[1] : "all";
+
+    if (which == "generator") {
+        return benchGenerator(argc - 2, argv + 2);
+    }
+    if (which == "keystroke") {
+        return benchKeystroke(argc - 2, argv + 2);
+    }
+    if (which == "display") {
+        return benchDisplay(argc - 2, argv + 2);
+    }
+    if (which == "rain") {
+        return benchRain(argc - 2, argv + 2);
+    }
+    if (which == "serve") {
+        return benchServe(argc - 2, argv + 2);
+    }
+    if (which == "verify") {
+        return benchVerify(argc - 2, argv + 2);
+    }
+    if (which == "all") {
+        return benchGenerator(0, argv) || benchKeystroke(0, argv) || benchDisplay(0, argv) || benchRain(0, argv) ||
+               benchServe(0, argv) || benchVerify(0, argv);
+    }
+
+    std::cerr << "Usage: hackertyper_bench [all | BENCH [OPTIONS]]\n"
+              << "  generator [--order N] [--mb N] [FILE...]\n"
+              << "  keystroke [--rows N] [--cols N] [--keys N] [--chars N] [--max-mb N (32)] [--highlight]\n"
+              << "            [--sink null|pipe|vt] [--dir DIR]\n"
+              << "  display [--rows N] [--cols N] [--frames N] [--sink null|pipe|vt]\n"
+              << "  rain [--rows N] [--cols N] [--frames N] [--sink null|pipe|vt]\n"
+              << "  serve [--sessions N] [--rounds N]\n"
+              << "  verify [--keys N] [FILE]" << std::endl;
+    return 1;
+}
@@ -1,49 +1,311 @@
 #include <iostream>
 #include <cstdlib>
+#include <cstdio>
 #include <fstream>
 #include <sstream>
 #include <random>
 #include <vector>
 #include <string>
-#include <regex>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#include <bitset>
+#include <map>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <new>
+#include <csignal>
 #include <dirent.h>
 #include <libgen.h>  // Add this for dirname()
 #include <unistd.h>  // Add this for readlink()
+#include <sys/stat.h>
 
 // OS-specific includes
+#if defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>
+#endif
 #ifdef _WIN32
+    #include <intrin.h>
     #include <conio.h>  // For _kbhit() and _getch()
     #include <Windows.h> // For Windows-specific functions
 #else
+    #include <cerrno>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <sys/epoll.h>
+    #include <sys/eventfd.h>
+    #include <sys/inotify.h>
+    #include <sys/ioctl.h>
+    #include <sys/mman.h>
+    #include <sys/resource.h>
     #include <sys/select.h>
+    #include <sys/signalfd.h>
+    #include <sys/socket.h>
+    #include <sys/timerfd.h>
+    #include <sys/un.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <arpa/inet.h>
     #include <termios.h>
     #include <unistd.h>
 #endif
-struct fullpath;
+// Glob pattern compiled once into tokens: literal runs, '?', '*' and [...] classes
+struct GlobPattern {
+    enum Kind { LITERAL, ANY, STAR, CLASS };
+    struct Token {
+        Kind kind;
+        std::string literal;
+        std::bitset<256> chars;  // CLASS members
+    };
+    std::string source;
+    std::vector<Token> tokens;
+};
+
+// Function to find the ']' closing a class opened at pattern[open]; the first
+// character after '[' (or after '!'/'^') is a member even if it is ']'. npos
+// when the class is never closed, which makes the '[' a literal
+size_t globClassEnd(const std::string& pattern, size_t open) {
+    size_t body = open + 1;
+    if (body < pattern.size() && (pattern[body] == '!' || pattern[body] == '^')) body++;
+    if (body >= pattern.size()) return std::string::npos;
+    return pattern.find(']', body + 1);
+}
+
+// Function to compile a glob pattern
+GlobPattern compileGlob(const std::string& pattern) {
+    GlobPattern glob;
+    glob.source = pattern;
+    for (size_t k = 0; k < pattern.size(); k++) {
+        char c = pattern[k];
+        size_t end = c == '[' ? globClassEnd(pattern, k) : std::string::npos;
+        if (c == '*') {
+            if (glob.tokens.empty() || glob.tokens.back().kind != GlobPattern::STAR) {
+                glob.tokens.push_back({ GlobPattern::STAR, "", {} });
+            }
+        } else if (c == '?') {
+            glob.tokens.push_back({ GlobPattern::ANY, "", {} });
+        } else if (end != std::string::npos) {
+            GlobPattern::Token token = { GlobPattern::CLASS, "", {} };
+            bool negate = pattern[k + 1] == '!' || pattern[k + 1] == '^';
+            size_t p = k + 1 + negate;
+            for (; p < end; p++) {
+                unsigned char from = pattern[p];
+                unsigned char to = from;
+                if (p + 2 < end && pattern[p + 1] == '-') {
+                    to = pattern[p + 2];
+                    p += 2;
+                }
+                for (unsigned v = from; v <= to; v++) token.chars.set(v);
+            }
+            if (negate) token.chars.flip();
+            glob.tokens.push_back(token);
+            k = end;
+        } else {
+            if (glob.tokens.empty() || glob.tokens.back().kind != GlobPattern::LITERAL) {
+                glob.tokens.push_back({ GlobPattern::LITERAL, "", {} });
+            }
+            glob.tokens.back().literal += c;
+        }
+    }
+    return glob;
+}
+
+// Function to match a name against a compiled glob, backtracking only to the last '*'
+bool matchGlob(const GlobPattern& glob, const char* name) {
+    size_t len = strlen(name);
+    size_t t = 0, p = 0;
+    size_t starToken = std::string::npos, starPos = 0;
+
+    while (p < len) {
+        if (t < glob.tokens.size()) {
+            const GlobPattern::Token& token = glob.tokens[t];
+            if (token.kind == GlobPattern::STAR) {
+                starToken = t++;
+                starPos = p;
+                continue;
+            }
+            if (token.kind == GlobPattern::LITERAL) {
+                if (len - p >= token.literal.size() &&
+                    memcmp(name + p, token.literal.data(), token.literal.size()) == 0) {
+                    p += token.literal.size();
+                    t++;
+                    continue;
+                }
+            } else if (token.kind == GlobPattern::ANY ||
+                       token.chars.test((unsigned char)name[p])) {
+                p++;
+                t++;
+                continue;
+            }
+        }
+        if (starToken == std::string::npos) return false;
+        t = starToken + 1;
+        p = ++starPos;
+    }
+
+    while (t < glob.tokens.size() && glob.tokens[t].kind == GlobPattern::STAR) t++;
+    return t == glob.tokens.size();
+}
 
 // Function to list all matching files in a directory
-std::vector<std::string> listMatchingFiles(const std::string& directory, const std::string& pattern) {
+std::vector<std::string> listMatchingFiles(const std::string& directory, const GlobPattern& pattern, bool verbose) {
     std::vector<std::string> result;
     DIR* dir;
     struct dirent* entry;
-    std::regex filePattern(pattern);
     
     if ((dir = opendir(directory.c_str())) != nullptr) {
         while ((entry = readdir(dir)) != nullptr) {
-            std::string filename = entry->d_name;
-            if (std::regex_match(filename, filePattern)) {
-                result.push_back(directory + "/" + filename);
-                struct fullpath;
-                std::string fullpath = directory + "/" + filename;
-                std::cout << "Found file: " << fullpath << std::endl;
+            if (matchGlob(pattern, entry->d_name)) {
+                result.push_back(directory + "/" + entry->d_name);
+                if (verbose) {
+                    std::cout << "Found file: " << result.back() << std::endl;
+                }
             }
         }
         closedir(dir);
     }
-    
+
+    // readdir order is arbitrary; keep the list stable between runs
+    std::sort(result.begin(), result.end());
     return result;
 }
 
+// On-disk cache of discovery results, keyed by directory and its mtime.
+// Adding, removing or renaming a file bumps the directory mtime, so a
+// matching entry can be trusted without reading the directory again.
+struct DiscoveryCache {
+    struct Entry {
+        long long mtimeSec = 0;
+        long long mtimeNsec = 0;
+        std::string pattern;
+        std::vector<std::string> files;
+    };
+    std::map<std::string, Entry> dirs;
+    bool changed = false;
+};
+
+// Function to locate the cache file ($XDG_CACHE_HOME or ~/.cache)
+std::string discoveryCachePath() {
+    const char* base = getenv("XDG_CACHE_HOME");
+    if (base && *base) return std::string(base) + "/hackertyper/corpus-list";
+    const char* home = getenv("HOME");
+    if (home && *home) return std::string(home) + "/.cache/hackertyper/corpus-list";
+    return "";
+}
+
+// Function to read the cache; a missing or foreign file is just an empty cache
+void loadDiscoveryCache(DiscoveryCache& cache) {
+    std::ifstream file(discoveryCachePath());
+    std::string line;
+    if (!std::getline(file, line) || line != "hackertyper-discovery 1") return;
+
+    DiscoveryCache::Entry* current = nullptr;
+    while (std::getline(file, line)) {
+        if (line.compare(0, 2, "D ") == 0) {
+            // D <mtime sec> <mtime nsec> <pattern>\t<directory>
+            std::istringstream fields(line.substr(2));
+            DiscoveryCache::Entry entry;
+            fields >> entry.mtimeSec >> entry.mtimeNsec >> std::ws;
+            std::string rest;
+            std::getline(fields, rest);
+            size_t tab = rest.find('\t');
+            if (tab == std::string::npos) {
+                current = nullptr;
+                continue;
+            }
+            entry.pattern = rest.substr(0, tab);
+            current = &(cache.dirs[rest.substr(tab + 1)] = entry);
+        } else if (line.compare(0, 2, "F ") == 0 && current) {
+            current->files.push_back(line.substr(2));
+        }
+    }
+}
+
+// Function to write the cache back if it changed; written aside and renamed
+// into place so concurrent launches never read half a file
+void saveDiscoveryCache(const DiscoveryCache& cache) {
+    std::string path = discoveryCachePath();
+    if (!cache.changed || path.empty()) return;
+
+    #ifndef _WIN32
+    std::string dir = path.substr(0, path.find_last_of('/'));
+    mkdir(dir.substr(0, dir.find_last_of('/')).c_str(), 0755);
+    mkdir(dir.c_str(), 0755);
+    #endif
+
+    std::string temp = path + "." + std::to_string(getpid());
+    {
+        std::ofstream file(temp);
+        file << "hackertyper-discovery 1\n";
+        for (const auto& dir : cache.dirs) {
+            file << "D " << dir.second.mtimeSec << " " << dir.second.mtimeNsec << " "
+                 << dir.second.pattern << "\t" << dir.first << "\n";
+            for (const auto& name : dir.second.files) {
+                file << "F " << name << "\n";
+            }
+        }
+        if (!file) return;
+    }
+    std::rename(temp.c_str(), path.c_str());
+}
+
+// Function to list matching files, answering from the cache while the directory is unchanged
+std::vector<std::string> listMatchingFilesCached(const std::string& directory, const GlobPattern& pattern,
+                                                 DiscoveryCache* cache, bool verbose) {
+    struct stat info;
+    if (stat(directory.c_str(), &info) != 0) return {};
+
+    #ifdef _WIN32
+    long long sec = info.st_mtime, nsec = 0;
+    #else
+    long long sec = info.st_mtim.tv_sec, nsec = info.st_mtim.tv_nsec;
+    #endif
+
+    // Entries are keyed by the canonical directory and hold bare file names,
+    // so "." from different working directories never collide
+    std::string key = directory;
+    #ifndef _WIN32
+    char resolved[PATH_MAX];
+    if (realpath(directory.c_str(), resolved)) key = resolved;
+    #endif
+
+    std::vector<std::string> files;
+    if (cache) {
+        auto hit = cache->dirs.find(key);
+        if (hit != cache->dirs.end() && hit->second.mtimeSec == sec &&
+            hit->second.mtimeNsec == nsec && hit->second.pattern == pattern.source) {
+            if (verbose) {
+                std::cout << "Cached: " << directory << " (" << hit->second.files.size() << " files)" << std::endl;
+            }
+            for (const auto& name : hit->second.files) {
+                files.push_back(directory + "/" + name);
+            }
+            return files;
+        }
+    }
+
+    files = listMatchingFiles(directory, pattern, verbose);
+    if (cache) {
+        DiscoveryCache::Entry& entry = cache->dirs[key];
+        entry.mtimeSec = sec;
+        entry.mtimeNsec = nsec;
+        entry.pattern = pattern.source;
+        entry.files.clear();
+        for (const auto& file : files) {
+            entry.files.push_back(file.substr(directory.size() + 1));
+        }
+        cache->changed = true;
+    }
+    return files;
+}
+
 // Function to read text from file
 std::string readTextFromFile(const std::string& filename) {
     std::ifstream file(filename);
@@ -57,446 +319,5215 @@ std::string readTextFromFile(const std::string& filename) {
     return buffer.str();
 }
 
-// Get executable directory
-std::string getExecutableDir() {
-    char result[PATH_MAX];
-    ssize_t count = readlink("/proc/self/exe", result, PATH_MAX);
-    if (count != -1) {
-        std::string path(result, count);
-        char* dir = dirname(&path[0]);
-        return std::string(dir);
+// Corpus text. On Linux the file is memory-mapped and typed straight out of
+// the page cache, so it is never read into or copied between buffers.
+struct Corpus {
+    std::string_view text;
+
+    Corpus() = default;
+    Corpus(const Corpus&) = delete;
+    Corpus& operator=(const Corpus&) = delete;
+    ~Corpus() { release(); }
+
+    bool load(const std::string& filename) {
+        release();
+        #ifndef _WIN32
+        int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            std::cerr << "Error opening file: " << filename << std::endl;
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+            void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                madvise(data, info.st_size, MADV_SEQUENTIAL);
+                mapping = data;
+                mappingSize = info.st_size;
+                text = std::string_view(static_cast<const char*>(data), mappingSize);
+            }
+        }
+        close(fd);
+        if (mapping) return true;
+        #endif
+
+        // Not mappable (Windows, pipes, special files): read it instead
+        owned = readTextFromFile(filename);
+        text = owned;
+        return !text.empty();
     }
-    return "."; // Fallback to current directory if we can't determine
-}
 
-// Cross-platform functions for terminal handling
-#ifdef _WIN32
-// Windows version
-void setupTerminal() {
-    // Nothing needed for Windows
-}
+    void release() {
+        #ifndef _WIN32
+        if (mapping) munmap(mapping, mappingSize);
+        #endif
+        mapping = nullptr;
+        mappingSize = 0;
+        owned.clear();
+        text = std::string_view();
+    }
 
-void resetTerminal() {
-    // Nothing needed for Windows
-}
+private:
+    void* mapping = nullptr;
+    size_t mappingSize = 0;
+    std::string owned;
+};
 
-bool kbhit() {
-    return _kbhit();
-}
+// Corpus pack: many corpora in one file so startup needs no directory scan
+// and switching corpora is a table lookup. Layout (little-endian):
+//
+//   PackHeader                      magic "HTPK", version, corpus count
+//   PackEntry[count]                one index entry per corpus
+//   names                           corpus names, back to back
+//   per corpus: text, then uint32 line starts (4-byte aligned)
+//
+// Offsets are from the start of the pack.
+struct PackHeader {
+    char magic[4];
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+};
 
-char getch() {
-    return _getch();
-}
+struct PackEntry {
+    uint64_t textOffset;
+    uint64_t textLength;
+    uint64_t linesOffset;
+    uint32_t lineCount;
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t reserved;
+};
 
-void sleep_ms(int ms) {
-    Sleep(ms);
-}
+const uint32_t kPackVersion = 1;
 
-void clearScreen() {
-    system("cls");
-}
+// Read-only view of a pack held in memory (mapped file or embedded array)
+struct CorpusPack {
+    const char* base = nullptr;
+    const PackEntry* entries = nullptr;
+    uint32_t count = 0;
 
-void setTextColor(int color) {
-    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-    SetConsoleTextAttribute(hConsole, color);
-}
+    std::string_view name(uint32_t k) const {
+        return std::string_view(base + entries[k].nameOffset, entries[k].nameLength);
+    }
 
-void setGreenText() {
-    setTextColor(FOREGROUND_GREEN | FOREGROUND_INTENSITY);
-}
+    std::string_view text(uint32_t k) const {
+        return std::string_view(base + entries[k].textOffset, entries[k].textLength);
+    }
 
-void setGrayText() {
-    setTextColor(FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE | FOREGROUND_INTENSITY);
-}
+    // Offset of each line's first character within text(k)
+    const uint32_t* lineStarts(uint32_t k) const {
+        return reinterpret_cast<const uint32_t*>(base + entries[k].linesOffset);
+    }
 
-void resetTextColor() {
-    setTextColor(FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+    uint32_t lineCount(uint32_t k) const {
+        return entries[k].lineCount;
+    }
+};
+
+// Function to validate a pack and index it; returns false if it is malformed
+bool openPack(std::string_view data, CorpusPack& pack) {
+    pack = CorpusPack();
+    if (data.size() < sizeof(PackHeader)) return false;
+
+    const PackHeader* header = reinterpret_cast<const PackHeader*>(data.data());
+    if (memcmp(header->magic, "HTPK", 4) != 0 || header->version != kPackVersion) return false;
+    if ((data.size() - sizeof(PackHeader)) / sizeof(PackEntry) < header->count) return false;
+
+    const PackEntry* entries = reinterpret_cast<const PackEntry*>(data.data() + sizeof(PackHeader));
+    for (uint32_t k = 0; k < header->count; k++) {
+        const PackEntry& e = entries[k];
+        if (e.textOffset > data.size() || e.textLength > data.size() - e.textOffset ||
+            e.linesOffset > data.size() || e.lineCount > (data.size() - e.linesOffset) / 4 ||
+            e.linesOffset % 4 != 0 ||
+            e.nameOffset > data.size() || e.nameLength > data.size() - e.nameOffset ||
+            e.textLength == 0 || e.lineCount == 0) {
+            return false;
+        }
+    }
+
+    pack.base = data.data();
+    pack.entries = entries;
+    pack.count = header->count;
+    return true;
 }
 
-#else
-// Linux/Unix version
-struct termios oldSettings, newSettings;
+// Function to build a pack from text files
+bool buildPack(const std::vector<std::string>& files, std::string& result) {
+    std::vector<PackEntry> entries(files.size());
+    std::string names;
+    std::string body;
 
-void setupTerminal() {
-    tcgetattr(fileno(stdin), &oldSettings);
-    newSettings = oldSettings;
-    newSettings.c_lflag &= (~ICANON & ~ECHO);
-    tcsetattr(fileno(stdin), TCSANOW, &newSettings);
+    for (size_t k = 0; k < files.size(); k++) {
+        Corpus corpus;
+        if (!corpus.load(files[k])) return false;
+        if (corpus.text.size() > UINT32_MAX) {
+            std::cerr << "Corpus too large for a pack: " << files[k] << std::endl;
+            return false;
+        }
+
+        std::string name = files[k].substr(files[k].find_last_of('/') + 1);
+        entries[k].nameOffset = names.size();
+        entries[k].nameLength = name.size();
+        names += name;
+
+        entries[k].textOffset = body.size();
+        entries[k].textLength = corpus.text.size();
+        body += corpus.text;
+        body.resize((body.size() + 3) & ~size_t(3), '\n');
+
+        std::vector<uint32_t> starts;
+        for (size_t p = 0; p < corpus.text.size(); p++) {
+            if (p == 0 || corpus.text[p - 1] == '\n') starts.push_back(p);
+        }
+        entries[k].linesOffset = body.size();
+        entries[k].lineCount = starts.size();
+        body.append(reinterpret_cast<const char*>(starts.data()), starts.size() * sizeof(uint32_t));
+    }
+
+    // Names follow the index; the bodies start 8-byte aligned after them
+    size_t namesStart = sizeof(PackHeader) + entries.size() * sizeof(PackEntry);
+    size_t bodyStart = (namesStart + names.size() + 7) & ~size_t(7);
+    for (PackEntry& e : entries) {
+        e.nameOffset += namesStart;
+        e.textOffset += bodyStart;
+        e.linesOffset += bodyStart;
+    }
+
+    PackHeader header = { { 'H', 'T', 'P', 'K' }, kPackVersion, (uint32_t)entries.size(), 0 };
+    result.assign(reinterpret_cast<const char*>(&header), sizeof(header));
+    result.append(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(PackEntry));
+    result += names;
+    result.resize(bodyStart, '\0');
+    result += body;
+    return true;
 }
 
-void resetTerminal() {
-    tcsetattr(fileno(stdin), TCSANOW, &oldSettings);
+// Function to write a pack file, or with embed a C++ source defining it as
+// embeddedPack/embeddedPackSize for linking into the executable
+bool writePack(const std::string& output, const std::vector<std::string>& files, bool embed) {
+    std::string pack;
+    if (files.empty() || !buildPack(files, pack)) {
+        std::cerr << "Error: cannot build corpus pack." << std::endl;
+        return false;
+    }
+
+    std::ofstream file(output, std::ios::binary);
+    if (!embed) {
+        file.write(pack.data(), pack.size());
+    } else {
+        file << "// Generated by hackertyper_pack --embed-pack. Do not edit.\n"
+             << "#include <cstddef>\n\n"
+             << "alignas(8) extern const unsigned char embeddedPack[] = {";
+        char byte[16];
+        for (size_t k = 0; k < pack.size(); k++) {
+            snprintf(byte, sizeof(byte), "%s%u,", k % 16 ? "" : "\n    ", (unsigned char)pack[k]);
+            file << byte;
+        }
+        file << "\n};\n\nextern const size_t embeddedPackSize = " << pack.size() << ";\n";
+    }
+
+    if (!file) {
+        std::cerr << "Error writing file: " << output << std::endl;
+        return false;
+    }
+    return true;
 }
 
-bool kbhit() {
-    fd_set readfds;
-    struct timeval tv;
-    
-    FD_ZERO(&readfds);
-    FD_SET(STDIN_FILENO, &readfds);
-    
-    tv.tv_sec = 0;
-    tv.tv_usec = 1000;
-    
-    return select(STDIN_FILENO + 1, &readfds, NULL, NULL, &tv) > 0;
+#ifndef HACKERTYPER_NO_EMBEDDED_PACK
+// Default pack compiled in by CMake from hackertext*.txt
+extern const unsigned char embeddedPack[];
+extern const size_t embeddedPackSize;
+#endif
+
+// Function to count the trailing zero bits of a non-zero word
+inline int countTrailingZeros(uint64_t word) {
+    #ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward64(&index, word);
+    return index;
+    #else
+    return __builtin_ctzll(word);
+    #endif
 }
 
-char getch() {
-    char buf = 0;
-    if (read(STDIN_FILENO, &buf, 1) > 0) {
-        return buf;
+// Function to decode the UTF-8 sequence at the start of text. Returns its
+// length, or 0 if it is malformed or cut off (overlong forms, surrogates
+// and values past U+10FFFF count as malformed).
+inline size_t utf8Decode(const char* text, size_t size, uint32_t& codepoint) {
+    unsigned char c = text[0];
+    size_t length;
+    if (c < 0x80) {
+        codepoint = c;
+        return 1;
+    } else if (c >= 0xC2 && c <= 0xDF) {
+        codepoint = c & 0x1F;
+        length = 2;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        codepoint = c & 0x0F;
+        length = 3;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        codepoint = c & 0x07;
+        length = 4;
+    } else {
+        return 0;
     }
-    return 0;
+    if (size < length) return 0;
+    for (size_t k = 1; k < length; k++) {
+        unsigned char next = text[k];
+        if ((next & 0xC0) != 0x80) return 0;
+        codepoint = (codepoint << 6) | (next & 0x3F);
+    }
+    if ((length == 3 && (codepoint < 0x800 || (codepoint >= 0xD800 && codepoint <= 0xDFFF))) ||
+        (length == 4 && (codepoint < 0x10000 || codepoint > 0x10FFFF))) {
+        return 0;
+    }
+    return length;
 }
 
-void sleep_ms(int ms) {
-    usleep(ms * 1000);
+// Function to give the columns a codepoint takes on a terminal: 0 for
+// combining marks and other zero-width characters, 2 for East Asian wide
+// characters and emoji, 1 otherwise. The same ranges as wcwidth().
+int codepointWidth(uint32_t cp) {
+    if (cp < 0x300) return 1;
+    if ((cp <= 0x36F) || (cp >= 0x483 && cp <= 0x489) || (cp >= 0x591 && cp <= 0x5BD) ||
+        (cp >= 0x610 && cp <= 0x61A) || (cp >= 0x64B && cp <= 0x65F) ||
+        (cp >= 0x1AB0 && cp <= 0x1AFF) || (cp >= 0x1DC0 && cp <= 0x1DFF) ||
+        (cp >= 0x200B && cp <= 0x200F) || (cp >= 0x20D0 && cp <= 0x20FF) ||
+        (cp >= 0xFE00 && cp <= 0xFE0F) || (cp >= 0xFE20 && cp <= 0xFE2F) ||
+        (cp >= 0x1F3FB && cp <= 0x1F3FF) || (cp >= 0xE0100 && cp <= 0xE01EF)) {
+        return 0;
+    }
+    if ((cp >= 0x1100 && cp <= 0x115F) || (cp >= 0x2E80 && cp <= 0xA4CF && cp != 0x303F) ||
+        (cp >= 0xAC00 && cp <= 0xD7A3) || (cp >= 0xF900 && cp <= 0xFAFF) ||
+        (cp >= 0xFE30 && cp <= 0xFE4F) || (cp >= 0xFF00 && cp <= 0xFF60) ||
+        (cp >= 0xFFE0 && cp <= 0xFFE6) || (cp >= 0x1F300 && cp <= 0x1F64F) ||
+        (cp >= 0x1F900 && cp <= 0x1F9FF) || (cp >= 0x20000 && cp <= 0x3FFFD)) {
+        return 2;
+    }
+    return 1;
 }
 
-void clearScreen() {
-    system("clear");
+// Function to measure the glyph starting at text[k]: returns its columns
+// (0, 1 or 2) and sets length to its bytes. A cut-off or malformed
+// sequence counts as one column, one byte at a time.
+inline int measureGlyph(const char* text, size_t n, size_t k, size_t& length) {
+    length = 1;
+    if ((unsigned char)text[k] < 0xC0) return 1;
+    uint32_t cp;
+    size_t decoded = utf8Decode(text + k, n - k, cp);
+    if (decoded == 0) return 1;
+    length = decoded;
+    return codepointWidth(cp);
 }
 
-void setGreenText() {
-    std::cout << "\033[32;1m"; // Set bright green color
+// Tabs expand to the next multiple of kTabWidth columns, stopping at the
+// right edge like a terminal's own tab stops
+const int kTabWidth = 8;
+
+// Function to find the column a tab at col moves to
+inline int tabStop(int col, int cols) {
+    return std::max(col, std::min((col / kTabWidth + 1) * kTabWidth, cols));
 }
 
-void setGrayText() {
-    std::cout << "\033[0m\033[37m"; // Set light gray text
+// Function to find the length of the leading run of ASCII bytes, 16 at a
+// time with SSE2 where available and 8 at a time otherwise
+size_t asciiPrefix(const char* text, size_t size) {
+    size_t k = 0;
+    #if defined(__SSE2__) || defined(_M_X64)
+    for (; k + 16 <= size; k += 16) {
+        int high = _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(text + k)));
+        if (high) return k + countTrailingZeros(high);
+    }
+    #else
+    for (; k + 8 <= size; k += 8) {
+        uint64_t word;
+        memcpy(&word, text + k, 8);
+        if (word & 0x8080808080808080ULL) break;
+    }
+    #endif
+    while (k < size && (unsigned char)text[k] < 0x80) k++;
+    return k;
 }
 
-void resetTextColor() {
-    std::cout << "\033[0m"; // Reset color
+// Function to tell whether a codepoint continues the grapheme cluster of
+// the one before it: combining marks and other zero-width characters,
+// anything after a zero-width joiner, and the second of a pair of regional
+// indicators (a flag). regionalPair tracks pairing along the text.
+inline bool extendsCluster(uint32_t previous, uint32_t cp, bool& regionalPair) {
+    bool regional = cp >= 0x1F1E6 && cp <= 0x1F1FF;
+    bool extends = codepointWidth(cp) == 0 || previous == 0x200D || (regional && regionalPair);
+    regionalPair = regional && !regionalPair;
+    return extends;
 }
-#endif
 
-// Function to display a progress bar
-void showProgressBar(const std::string& label, int duration_ms) {
-    std::cout << label;
-    const int width = 30;
-    for (int i = 0; i < width; i++) {
-        std::cout << "█";
-        std::cout.flush();
-        sleep_ms(duration_ms / width);
+// Character boundaries of a text, so the reveal cursor steps whole
+// characters (grapheme clusters: a base character with the combining marks,
+// joiners and modifiers that follow it) instead of bytes. The text is
+// validated and indexed in blocks the first time the cursor enters them,
+// so a large mapped corpus is never read ahead of the cursor. An ASCII
+// block (the common case) is only flagged; every byte in it is a character.
+// A mixed block gets a bitmap with one bit per byte marking cluster starts.
+// Malformed bytes count as one character each.
+struct TextIndex {
+    static const size_t kBlockBits = 16;
+    static const size_t kBlockSize = size_t(1) << kBlockBits;
+    enum BlockState : uint8_t { UNINDEXED, ASCII, MIXED };
+
+    std::string_view text;
+    std::vector<uint8_t> blocks;                   // BlockState per block
+    std::vector<std::vector<uint64_t>> starts;     // Cluster-start bitmap of MIXED blocks
+    size_t invalidBytes = 0;
+
+    // Function to start over on a (new) text
+    void reset(std::string_view newText) {
+        text = newText;
+        size_t count = (text.size() + kBlockSize - 1) >> kBlockBits;
+        blocks.assign(count, UNINDEXED);
+        starts.clear();
+        starts.resize(count);
+        invalidBytes = 0;
     }
-    std::cout << " [COMPLETE]" << std::endl;
-}
 
-// Function to simulate typing text
-void typeText(const std::string& text, int delay_ms) {
-    for (char c : text) {
-        std::cout << c;
-        std::cout.flush();
-        sleep_ms(delay_ms);
+    // Function to validate and index one block
+    void indexBlock(size_t block) {
+        size_t begin = block << kBlockBits;
+        size_t end = std::min(begin + kBlockSize, text.size());
+        size_t p = begin + asciiPrefix(text.data() + begin, end - begin);
+        if (p == end) {
+            blocks[block] = ASCII;
+            return;
+        }
+
+        std::vector<uint64_t>& bits = starts[block];
+        bits.assign(kBlockSize / 64, 0);
+        auto mark = [&](size_t from, size_t to) {
+            for (size_t k = from - begin; k < to - begin; ) {
+                size_t bit = k & 63, span = std::min(64 - bit, to - begin - k);
+                bits[k >> 6] |= (span == 64 ? ~uint64_t(0) : ((uint64_t(1) << span) - 1)) << bit;
+                k += span;
+            }
+        };
+        mark(begin, p);
+
+        // The block may start inside a sequence begun in the previous one
+        if (p == begin) {
+            while (p < end && p < begin + 3 && ((unsigned char)text[p] & 0xC0) == 0x80) p++;
+        }
+
+        uint32_t previous = p > 0 ? (unsigned char)text[p - 1] : 0;
+        bool regionalPair = false;
+        while (p < end) {
+            size_t run = asciiPrefix(text.data() + p, end - p);
+            if (run > 0) {
+                // "\r\n" is one cluster
+                size_t from = (previous == '\r' && text[p] == '\n') ? p + 1 : p;
+                mark(from, p + run);
+                p += run;
+                previous = (unsigned char)text[p - 1];
+                regionalPair = false;
+                continue;
+            }
+
+            uint32_t cp;
+            size_t length = utf8Decode(text.data() + p, text.size() - p, cp);
+            if (length == 0) {
+                invalidBytes++;
+                mark(p, p + 1);
+                p++;
+                previous = 0xFFFD;
+                continue;
+            }
+            if (!extendsCluster(previous, cp, regionalPair)) mark(p, p + 1);
+            previous = cp;
+            p += length;
+        }
+        blocks[block] = MIXED;
     }
-    std::cout << std::endl;
-}
 
-// Function to display a fake error
-void showFakeError() {
-    #ifdef _WIN32
-    setTextColor(FOREGROUND_RED | FOREGROUND_INTENSITY);
-    #else
-    std::cout << "\033[31;1m"; // Set bright red color on Unix/Linux
-    #endif
-    
-    std::cout << "\n*** ERROR 0x" << std::hex << (rand() % 0xFFFF) << ": Connection terminated" << std::endl;
-    std::cout << "*** Recalibrating network parameters..." << std::endl;
-    sleep_ms(1000);
-    std::cout << "*** Attempting bypass sequence..." << std::endl;
-    sleep_ms(800);
-    std::cout << "*** Rerouting through secondary node..." << std::endl;
-    sleep_ms(1200);
-    std::cout << "*** Connection reestablished" << std::endl << std::endl;
-    
-    resetTextColor();
-}
+    // Function to index every block up front, after which advance() never
+    // writes to the index and it can be shared
+    void indexAll() {
+        for (size_t block = 0; block < blocks.size(); block++) {
+            if (blocks[block] == UNINDEXED) indexBlock(block);
+        }
+    }
 
-// Function to display matrix-style rain effect
-void showMatrixRain(int duration_ms) {
-    clearScreen();
-    setGreenText();
-    
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> charDist(33, 126); // ASCII printable characters
-    std::uniform_int_distribution<> posDist(0, 79);    // Screen width
-    
-    int end_time = duration_ms;
-    int current_time = 0;
-    int interval = 50; // Update interval in milliseconds
-    
-    while (current_time < end_time) {
-        // Clear screen occasionally
-        if (current_time % 500 == 0) {
-            clearScreen();
+    // Function to step up to n characters forward from pos, stopping at the
+    // end of the text. Returns the new position and takes the characters
+    // stepped over off n. A cluster is never cut, even across blocks.
+    size_t advance(size_t pos, size_t& n) {
+        while (pos < text.size()) {
+            size_t block = pos >> kBlockBits;
+            if (blocks[block] == UNINDEXED) indexBlock(block);
+            size_t blockEnd = std::min((block + 1) << kBlockBits, text.size());
+            if (blocks[block] == ASCII) {
+                if (n == 0) break;
+                size_t take = std::min(n, blockEnd - pos);
+                pos += take;
+                n -= take;
+                continue;
+            }
+
+            // Next set bit after pos within the block, a word at a time. When
+            // pos is inside a cluster that began in an earlier block, the
+            // rest of that cluster is taken without counting it again.
+            const std::vector<uint64_t>& bits = starts[block];
+            size_t begin = block << kBlockBits;
+            size_t offset = pos - begin;
+            if ((bits[offset >> 6] >> (offset & 63)) & 1) {
+                if (n == 0) break;
+                n--;
+            }
+            offset++;
+            pos = blockEnd;
+            while (offset < blockEnd - begin) {
+                uint64_t word = bits[offset >> 6] >> (offset & 63);
+                if (word) {
+                    pos = std::min(begin + offset + countTrailingZeros(word), blockEnd);
+                    break;
+                }
+                offset = (offset | 63) + 1;
+            }
         }
-        
-        // Display random characters
-        for (int i = 0; i < 10; i++) {
-            int x = posDist(gen);
-            char c = charDist(gen);
-            // Move cursor to random position and print char
-            std::cout << "\033[" << (current_time/100) % 24 << ";" << x << "H" << c;
+        return pos;
+    }
+};
+
+// Function to take up to n characters from the front of data without an
+// index (generated or streamed text), so a chunk never ends inside a
+// character when the rest of it is there. Returns the bytes taken and
+// takes the characters off n.
+size_t takeCharacters(const char* data, size_t size, size_t& n) {
+    size_t k = asciiPrefix(data, std::min(size, n));
+    n -= k;
+    uint32_t previous = k > 0 ? (unsigned char)data[k - 1] : 0;
+    bool regionalPair = false;
+    while (k < size) {
+        uint32_t cp = 0xFFFD;
+        size_t length = utf8Decode(data + k, size - k, cp);
+        if (length == 0) length = 1;
+        if (!extendsCluster(previous, cp, regionalPair)) {
+            if (n == 0) break;
+            n--;
         }
-        
-        std::cout.flush();
-        sleep_ms(interval);
-        current_time += interval;
+        previous = cp;
+        k += length;
     }
-    
-    clearScreen();
-    resetTextColor();
+    return k;
 }
 
-// Function to simulate IP scanning
-void simulateIPScan() {
-    setGreenText();
-    std::cout << "\nINITIATING NETWORK SCAN...\n" << std::endl;
-    
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> ipDist(1, 255);
-    
-    for (int i = 0; i < 8; i++) {
-        std::string ip = std::to_string(ipDist(gen)) + "." + 
-                          std::to_string(ipDist(gen)) + "." + 
-                          std::to_string(ipDist(gen)) + "." + 
-                          std::to_string(ipDist(gen));
-        std::cout << "Probing " << ip << "... ";
-        sleep_ms(200);
-        
-        if (i == 5 || i == 7) { // Make a couple of IPs "vulnerable"
-            std::cout << "VULNERABLE" << std::endl;
-            sleep_ms(300);
-            std::cout << "  └─ Port 22: OPEN (SSH)" << std::endl;
-            sleep_ms(100);
-            std::cout << "  └─ Port 80: OPEN (HTTP)" << std::endl;
-            if (i == 7) {
-                sleep_ms(100);
-                std::cout << "  └─ Port 3306: OPEN (MySQL)" << std::endl;
-                sleep_ms(300);
-                std::cout << "\nTARGET SELECTED: " << ip << std::endl;
-            }
-        } else {
-            std::cout << "SECURE" << std::endl;
+// The one random number generator everything draws from, seeded once in
+// main() (--seed, or from a replay), so a seeded run is reproducible
+std::mt19937 rng;
+
+// Where revealed text comes from: a corpus in memory or a stream
+class TextSource {
+public:
+    virtual ~TextSource() {}
+
+    // Function to hand out up to n next characters, taking the characters
+    // handed out off n. Fewer (or none) come back at a chunk boundary or
+    // when a stream has nothing buffered yet.
+    virtual std::string_view next(size_t& n) = 0;
+};
+
+// Types a corpus held in memory, wrapping back to the start at its end
+class CorpusSource : public TextSource {
+public:
+    std::string_view text;
+    size_t pos = 0;
+
+    std::string_view next(size_t& n) override {
+        if (text.empty()) return std::string_view();
+        if (index.text.data() != text.data() || index.text.size() != text.size()) {
+            index.reset(text);
         }
+        size_t end = index.advance(pos, n);
+        std::string_view chunk = text.substr(pos, end - pos);
+        pos = end;
+        if (pos >= text.size()) {
+            pos = 0;
+        }
+        return chunk;
     }
-    
-    resetTextColor();
+
+private:
+    TextIndex index;
+};
+
+// Character-level Markov model for endless code-like text. Every context of
+// `order` characters maps to a run in two flat arrays of successor bytes and
+// cumulative counts; contexts are found through an open-addressing table.
+struct MarkovModel {
+    int order = 0;
+    uint64_t mask = 0;                 // Keeps the low `order` bytes of a context
+
+    std::vector<uint64_t> slotKeys;    // Hash table of contexts, power-of-two sized
+    std::vector<uint32_t> slotFirst;   // First transition of the context
+    std::vector<uint32_t> slotCount;   // Transitions of the context; 0 marks an empty slot
+    std::vector<uint8_t> nextChar;     // Successor bytes, grouped by context
+    std::vector<uint32_t> cumulative;  // Running successor counts within each group
+
+    uint64_t startKey = 0;             // A context known to exist, to start from
+};
+
+inline uint64_t hashContext(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    return key;
 }
 
-// Function to show exit reminder
-void showExitReminder() {
-    int origRow, origCol;
-    // Save current cursor position (simplified)
-    origRow = 23; // Assuming a 24-line terminal
-    origCol = 0;
-    
-    // Go to bottom of screen
-    std::cout << "\033[" << origRow << ";0H";
-    setGrayText();
-    std::cout << "[ Press ESC to exit ]";
-    std::cout.flush();
-    
-    // Restore cursor position
-    std::cout << "\033[" << origRow - 3 << ";" << origCol << "H";
-    resetTextColor();
+// Function to find a context's slot, or the empty slot where it would go
+inline size_t findContext(const MarkovModel& model, uint64_t key) {
+    size_t slotMask = model.slotKeys.size() - 1;
+    size_t slot = hashContext(key) & slotMask;
+    while (model.slotCount[slot] != 0 && model.slotKeys[slot] != key) {
+        slot = (slot + 1) & slotMask;
+    }
+    return slot;
 }
 
-// Function to set up MS-DOS retro style
-void setupMSDOSStyle() {
-    clearScreen();
-    
-    // Set light gray text (DOS-like colors)
-    setGrayText();
-    std::cout << std::endl;
+// Function to train a model on the corpora; each corpus wraps around so
+// every context has at least one successor
+bool buildMarkovModel(const std::vector<std::string_view>& corpora, int order, MarkovModel& model) {
+    model = MarkovModel();
+    order = std::max(1, std::min(order, 7));
+    model.order = order;
+    model.mask = (1ULL << (8 * order)) - 1;
 
-    // Print DOS-like header
-    std::cout << "C:\\>HACK.EXE" << std::endl;
-    std::cout << "Microsoft(R) MS-DOS(R) Version 6.22" << std::endl;
-    std::cout << "(C)Copyright Microsoft Corp 1981-1994." << std::endl << std::endl;
+    // Every (context, successor) pair packed into one integer, then sorted
+    // so equal pairs and equal contexts end up next to each other
+    std::vector<uint64_t> pairs;
+    for (std::string_view text : corpora) {
+        if (text.size() <= (size_t)order) continue;
+        uint64_t key = 0;
+        for (int k = 0; k < order; k++) key = (key << 8) | (unsigned char)text[k];
+        if (pairs.empty()) model.startKey = key;
+        for (size_t p = order; p < text.size() + order; p++) {
+            unsigned char c = text[p % text.size()];
+            pairs.push_back((key << 8) | c);
+            key = ((key << 8) | c) & model.mask;
+        }
+    }
+    if (pairs.empty()) return false;
+    std::sort(pairs.begin(), pairs.end());
+
+    size_t contexts = 1;
+    for (size_t k = 1; k < pairs.size(); k++) {
+        if ((pairs[k] >> 8) != (pairs[k - 1] >> 8)) contexts++;
+    }
+    size_t slots = 16;
+    while (slots < contexts * 2) slots <<= 1;
+    model.slotKeys.assign(slots, 0);
+    model.slotFirst.assign(slots, 0);
+    model.slotCount.assign(slots, 0);
+
+    for (size_t k = 0; k < pairs.size(); ) {
+        uint64_t key = pairs[k] >> 8;
+        size_t slot = findContext(model, key);
+        model.slotKeys[slot] = key;
+        model.slotFirst[slot] = model.nextChar.size();
+
+        uint32_t running = 0;
+        while (k < pairs.size() && (pairs[k] >> 8) == key) {
+            size_t run = k;
+            while (run < pairs.size() && pairs[run] == pairs[k]) run++;
+            running += run - k;
+            model.nextChar.push_back(pairs[k] & 0xFF);
+            model.cumulative.push_back(running);
+            k = run;
+        }
+        model.slotCount[slot] = model.nextChar.size() - model.slotFirst[slot];
+    }
+    return true;
+}
+
+// Endless text sampled from a Markov model, generated a block at a time
+class GeneratorSource : public TextSource {
+public:
+    static const size_t kBlockSize = 64 * 1024;
+
+    GeneratorSource(const MarkovModel& trained, uint64_t seed)
+        : model(trained), key(trained.startKey), state(seed | 1) {
+        block.resize(kBlockSize);
+    }
+
+    std::string_view next(size_t& n) override {
+        if (pos == filled) {
+            filled = generate(block.data(), block.size());
+            pos = 0;
+        }
+        size_t take = takeCharacters(block.data() + pos, filled - pos, n);
+        std::string_view chunk(block.data() + pos, take);
+        pos += take;
+        return chunk;
+    }
+
+    // Function to write n generated bytes into out
+    size_t generate(char* out, size_t n) {
+        for (size_t k = 0; k < n; k++) {
+            size_t slot = findContext(model, key);
+            uint32_t first = model.slotFirst[slot];
+            uint32_t count = model.slotCount[slot];
+            if (count == 0) {
+                // Cannot happen with wrapped training, but never get stuck
+                key = model.startKey;
+                slot = findContext(model, key);
+                first = model.slotFirst[slot];
+                count = model.slotCount[slot];
+            }
+
+            const uint32_t* cumulative = &model.cumulative[first];
+            uint32_t pick = random() % cumulative[count - 1];
+            uint32_t choice = std::upper_bound(cumulative, cumulative + count, pick) - cumulative;
+
+            unsigned char c = model.nextChar[first + choice];
+            out[k] = c;
+            key = ((key << 8) | c) & model.mask;
+        }
+        return n;
+    }
+
+private:
+    const MarkovModel& model;
+    uint64_t key;
+    uint64_t state;
+    std::vector<char> block;
+    size_t pos = 0;
+    size_t filled = 0;
+
+    // xorshift64*: far cheaper than mt19937 and plenty random for fake code
+    uint32_t random() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return (state * 0x2545F4914F6CDD1DULL) >> 32;
+    }
+};
+
+#ifndef _WIN32
+// Streams a file, a directory tree or a pipe with bounded memory. A reader
+// thread fills a fixed pool of buffers ahead of the typing cursor, crossing
+// file boundaries on its own so the cursor never waits on open() or read().
+class StreamSource : public TextSource {
+public:
+    static const size_t kBufferSize = 64 * 1024;
+    static const size_t kBufferCount = 8;
+
+    // path is a file, a directory walked recursively for files matching one
+    // of the globs, or "-" for an already open descriptor (sourceFd)
+    StreamSource(const std::string& path, int sourceFd, const std::vector<GlobPattern>& globs)
+        : root(path), fd(sourceFd), patterns(globs), pool(kBufferCount * kBufferSize) {
+        for (size_t k = 0; k < kBufferCount; k++) {
+            freeBuffers.push_back(k);
+        }
+        // Signals belong to the typing thread's signalfd, so the reader starts with all of them blocked
+        sigset_t all, previous;
+        sigfillset(&all);
+        pthread_sigmask(SIG_BLOCK, &all, &previous);
+        reader = std::thread(&StreamSource::readAhead, this);
+        pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+    }
+
+    ~StreamSource() override {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        reader.join();
+    }
+
+    std::string_view next(size_t& n) override {
+        if (current == kNoBuffer || currentPos == currentLength) {
+            // Hand the finished buffer back and take the next filled one,
+            // without ever waiting for the reader
+            std::lock_guard<std::mutex> lock(mutex);
+            if (current != kNoBuffer) {
+                freeBuffers.push_back(current);
+                current = kNoBuffer;
+                wake.notify_one();
+            }
+            if (readyBuffers.empty()) {
+                if (!finished) stalls++;
+                return std::string_view();
+            }
+            current = readyBuffers.front().first;
+            currentLength = readyBuffers.front().second;
+            currentPos = 0;
+            readyBuffers.pop_front();
+        }
+
+        const char* data = pool.data() + current * kBufferSize + currentPos;
+        size_t take = takeCharacters(data, currentLength - currentPos, n);
+        std::string_view chunk(data, take);
+        currentPos += take;
+        return chunk;
+    }
+
+    // Times the cursor found nothing buffered while the stream was still going
+    unsigned long stalls = 0;
+
+private:
+    static const size_t kNoBuffer = ~size_t(0);
+
+    std::string root;
+    int fd;
+    std::vector<GlobPattern> patterns;
+
+    std::vector<char> pool;
+    std::deque<size_t> freeBuffers;
+    std::deque<std::pair<size_t, size_t>> readyBuffers;  // Buffer and bytes used
+    size_t current = kNoBuffer;
+    size_t currentPos = 0;
+    size_t currentLength = 0;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    bool finished = false;
+    std::thread reader;
+
+    // Reader side: the buffer being filled
+    size_t filling = kNoBuffer;
+    size_t filled = 0;
+    unsigned long long totalRead = 0;
+
+    // Function to publish the buffer being filled and wait for a free one; false when stopping
+    bool rotateBuffer() {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (filling != kNoBuffer && filled > 0) {
+            readyBuffers.emplace_back(filling, filled);
+            filling = kNoBuffer;
+        }
+        if (filling == kNoBuffer) {
+            wake.wait(lock, [this] { return stopping || !freeBuffers.empty(); });
+            if (stopping) return false;
+            filling = freeBuffers.front();
+            freeBuffers.pop_front();
+        }
+        filled = 0;
+        return true;
+    }
+
+    // Function to copy one descriptor into the buffers; false when stopping
+    bool pump(int source, bool interactive) {
+        while (true) {
+            if ((filling == kNoBuffer || filled == kBufferSize) && !rotateBuffer()) return false;
+
+            if (interactive) {
+                // A pipe may stay silent forever; look up now and then to see
+                // if we should stop, and hand over what has arrived so far
+                struct pollfd ready = { source, POLLIN, 0 };
+                if (poll(&ready, 1, 100) == 0) {
+                    if (filled > 0 && !rotateBuffer()) return false;
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (stopping) return false;
+                    continue;
+                }
+            }
+
+            size_t room = kBufferSize - filled;
+            ssize_t n = read(source, pool.data() + filling * kBufferSize + filled, room);
+            if (n < 0 && errno == EINTR) continue;
+            if (n <= 0) return true;
+            filled += n;
+            totalRead += n;
+
+            // A slow producer (tail -f) may never fill a buffer; a short read
+            // means it has nothing more for now, so publish what it sent
+            if (interactive && (size_t)n < room && !rotateBuffer()) return false;
+        }
+    }
+
+    bool wanted(const char* name) const {
+        for (const GlobPattern& glob : patterns) {
+            if (matchGlob(glob, name)) return true;
+        }
+        return false;
+    }
+
+    // Function to stream every matching file below root; false when stopping.
+    // Open directories are the only per-level state.
+    bool walk() {
+        std::vector<std::pair<DIR*, std::string>> stack;
+        DIR* top = opendir(root.c_str());
+        if (!top) return true;
+        stack.emplace_back(top, root);
+
+        bool going = true;
+        while (!stack.empty() && going) {
+            struct dirent* entry = readdir(stack.back().first);
+            if (!entry) {
+                closedir(stack.back().first);
+                stack.pop_back();
+                continue;
+            }
+            if (entry->d_name[0] == '.') continue;  // ., .. and hidden files like .git
+
+            std::string path = stack.back().second + "/" + entry->d_name;
+            struct stat info;
+            if (lstat(path.c_str(), &info) != 0) continue;
+
+            if (S_ISDIR(info.st_mode)) {
+                DIR* sub = opendir(path.c_str());
+                if (sub) stack.emplace_back(sub, path);
+            } else if (S_ISREG(info.st_mode) && wanted(entry->d_name)) {
+                int file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                if (file < 0) continue;
+                posix_fadvise(file, 0, 0, POSIX_FADV_SEQUENTIAL);
+                going = pump(file, false);
+                close(file);
+            }
+        }
+
+        for (auto& level : stack) closedir(level.first);
+        return going;
+    }
+
+    void readAhead() {
+        bool going = true;
+        if (fd >= 0) {
+            going = pump(fd, true);
+        } else {
+            struct stat info;
+            bool directory = stat(root.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+
+            // Files and trees repeat like a corpus; stop if a whole pass found nothing
+            while (going) {
+                unsigned long long before = totalRead;
+                if (directory) {
+                    going = walk();
+                } else {
+                    int file = open(root.c_str(), O_RDONLY | O_CLOEXEC);
+                    if (file >= 0) {
+                        going = pump(file, false);
+                        close(file);
+                    }
+                }
+                if (totalRead == before) break;
+            }
+        }
+
+        if (going) rotateBuffer();  // Publish the tail
+
+        std::lock_guard<std::mutex> lock(mutex);
+        finished = true;
+    }
+};
+
+// Corpus files watched for changes (--watch). A watcher thread re-reads and
+// re-indexes whatever changes in the corpus directory and publishes a new
+// snapshot; the typing side picks it up with one atomic exchange and never
+// waits for the watcher. Watched files are copied into memory rather than
+// mapped: a file rewritten in place would change under a mapping, or fault
+// it with SIGBUS once truncated.
+struct CorpusFile {
+    std::string path;
+    std::string text;
+    mutable TextIndex index;   // Complete before publishing, so advance() only reads it
+    dev_t device = 0;
+    ino_t inode = 0;
+    off_t size = 0;
+    long long mtimeSec = 0;
+    long long mtimeNsec = 0;
+};
+
+// Every corpus file in the directory at one moment. Snapshots and files are
+// never modified once published. Unchanged files are shared with the previous
+// snapshot, and each reader holds a reference to the file it types from, so a
+// replaced file is freed when the last reader moves off it.
+struct CorpusSnapshot {
+    uint64_t generation = 0;
+    std::vector<std::shared_ptr<const CorpusFile>> files;   // Sorted by path
+};
+
+// Function to read one corpus file, reusing the previous copy when the file
+// is unchanged; null if it is gone or empty
+std::shared_ptr<const CorpusFile> loadCorpusFile(const std::string& path, const CorpusSnapshot* previous) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return nullptr;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode) || info.st_size == 0) {
+        close(fd);
+        return nullptr;
+    }
+
+    if (previous) {
+        for (const auto& old : previous->files) {
+            if (old->path == path && old->device == info.st_dev && old->inode == info.st_ino &&
+                old->size == info.st_size && old->mtimeSec == info.st_mtim.tv_sec &&
+                old->mtimeNsec == info.st_mtim.tv_nsec) {
+                close(fd);
+                return old;
+            }
+        }
+    }
+
+    std::shared_ptr<CorpusFile> file = std::make_shared<CorpusFile>();
+    file->path = path;
+    file->device = info.st_dev;
+    file->inode = info.st_ino;
+    file->size = info.st_size;
+    file->mtimeSec = info.st_mtim.tv_sec;
+    file->mtimeNsec = info.st_mtim.tv_nsec;
+    file->text.resize(info.st_size);
+    size_t filled = 0;
+    while (filled < file->text.size()) {
+        ssize_t n = read(fd, &file->text[filled], file->text.size() - filled);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        filled += n;
+    }
+    close(fd);
+    file->text.resize(filled);  // Shrunk while we read it
+    if (file->text.empty()) return nullptr;
+    file->index.reset(file->text);
+    file->index.indexAll();
+    return file;
+}
+
+// Function to build a snapshot of the matching files in a directory
+std::shared_ptr<const CorpusSnapshot> loadCorpusSnapshot(const std::string& directory, const GlobPattern& pattern,
+                                                         const CorpusSnapshot* previous) {
+    std::shared_ptr<CorpusSnapshot> snapshot = std::make_shared<CorpusSnapshot>();
+    snapshot->generation = previous ? previous->generation + 1 : 1;
+    for (const std::string& path : listMatchingFiles(directory, pattern, false)) {
+        std::shared_ptr<const CorpusFile> file = loadCorpusFile(path, previous);
+        if (file) snapshot->files.push_back(std::move(file));
+    }
+    return snapshot;
+}
+
+class CorpusWatcher {
+public:
+    // Function to load the directory's corpus files and start watching it;
+    // false if there is nothing to type or inotify is unavailable
+    bool start(const std::string& dir) {
+        directory = dir;
+        current = loadCorpusSnapshot(directory, pattern, nullptr);
+        if (current->files.empty()) return false;
+
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (inotifyFd < 0 || stopFd < 0 ||
+            inotify_add_watch(inotifyFd, directory.c_str(),
+                              IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM) < 0) {
+            return false;
+        }
+
+        // Signals belong to the typing thread's signalfd, so the watcher starts with all of them blocked
+        sigset_t all, previous;
+        sigfillset(&all);
+        pthread_sigmask(SIG_BLOCK, &all, &previous);
+        watcher = std::thread(&CorpusWatcher::watch, this);
+        pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+        return true;
+    }
+
+    ~CorpusWatcher() {
+        if (watcher.joinable()) {
+            uint64_t one = 1;
+            if (write(stopFd, &one, sizeof(one)) < 0) {}
+            watcher.join();
+        }
+        if (inotifyFd >= 0) close(inotifyFd);
+        if (stopFd >= 0) close(stopFd);
+        delete published.exchange(nullptr);
+    }
+
+    // Function to get the newest snapshot; typing thread only. Taking a
+    // published one is a single atomic exchange, and the snapshot it replaces
+    // goes away with its last reference.
+    const std::shared_ptr<const CorpusSnapshot>& latest() {
+        if (published.load(std::memory_order_relaxed)) {
+            std::shared_ptr<const CorpusSnapshot>* fresh = published.exchange(nullptr, std::memory_order_acquire);
+            if (fresh) {
+                current = std::move(*fresh);
+                delete fresh;
+                reloads++;
+            }
+        }
+        return current;
+    }
+
+    // Function to tell whether start() found any corpus files
+    bool loaded() const {
+        return current && !current->files.empty();
+    }
+
+    // Snapshots taken up by the typing thread
+    unsigned long reloads = 0;
+
+private:
+    static constexpr std::chrono::milliseconds kSettle{200};
+    static constexpr std::chrono::milliseconds kMaxDelay{1000};
+
+    const GlobPattern pattern = compileGlob("hackertext*.txt");
+    std::string directory;
+    int inotifyFd = -1;
+    int stopFd = -1;
+    std::thread watcher;
+
+    std::shared_ptr<const CorpusSnapshot> current;                            // Typing thread
+    std::atomic<std::shared_ptr<const CorpusSnapshot>*> published{nullptr};   // Handed over, not yet taken
+
+    // Function to read pending events; true if one concerned a corpus file
+    bool drainEvents() {
+        alignas(struct inotify_event) char buffer[4096];
+        bool relevant = false;
+        ssize_t n;
+        while ((n = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+            for (ssize_t k = 0; k < n; ) {
+                const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(buffer + k);
+                if (event->len > 0 && matchGlob(pattern, event->name)) relevant = true;
+                if (event->mask & IN_Q_OVERFLOW) relevant = true;
+                k += sizeof(struct inotify_event) + event->len;
+            }
+        }
+        return relevant;
+    }
+
+    void watch() {
+        // Only this thread builds snapshots; it keeps the last one to reuse unchanged files
+        std::shared_ptr<const CorpusSnapshot> built = current;
+        struct pollfd fds[2] = { { inotifyFd, POLLIN, 0 }, { stopFd, POLLIN, 0 } };
+        bool dirty = false;
+        std::chrono::steady_clock::time_point reloadAt, latestReload;
+
+        while (true) {
+            int timeout = -1;
+            if (dirty) {
+                auto wait = std::min(reloadAt, latestReload) - std::chrono::steady_clock::now();
+                timeout = std::max<long long>(0, std::chrono::ceil<std::chrono::milliseconds>(wait).count());
+            }
+            int ready = poll(fds, 2, timeout);
+            if (ready < 0 && errno != EINTR) return;
+            if (fds[1].revents & POLLIN) return;
+
+            // Wait for things to settle (a copy arrives as several events)
+            // before reloading, but no longer than kMaxDelay after the first
+            // change, or a file rewritten all the time would never reload
+            auto now = std::chrono::steady_clock::now();
+            if (ready > 0 && (fds[0].revents & POLLIN) && drainEvents()) {
+                if (!dirty) latestReload = now + kMaxDelay;
+                reloadAt = now + kSettle;
+                dirty = true;
+            }
+            if (!dirty || now < std::min(reloadAt, latestReload)) continue;
+            dirty = false;
+
+            std::shared_ptr<const CorpusSnapshot> next = loadCorpusSnapshot(directory, pattern, built.get());
+            if (next->files.empty() || next->files == built->files) continue;  // Keep typing what we have
+            built = next;
+            delete published.exchange(new std::shared_ptr<const CorpusSnapshot>(std::move(next)),
+                                      std::memory_order_release);
+        }
+    }
+};
+
+// Function to carry a reader over to a new snapshot: the same file if it is
+// still there, at the start of the line it was on, otherwise a random file
+// at a random line
+void followSnapshot(const CorpusSnapshot& snapshot, std::shared_ptr<const CorpusFile>& file, size_t& pos) {
+    std::shared_ptr<const CorpusFile> same;
+    for (const auto& candidate : snapshot.files) {
+        if (file && candidate->path == file->path) same = candidate;
+    }
+    if (same == file && file) return;
+
+    if (same) {
+        pos = std::min(pos, same->text.size());
+    } else {
+        same = snapshot.files[std::uniform_int_distribution<size_t>(0, snapshot.files.size() - 1)(rng)];
+        pos = std::uniform_int_distribution<size_t>(0, same->text.size() - 1)(rng);
+    }
+    file = std::move(same);
+
+    // Back to a line start, which is always a character boundary
+    const std::string& text = file->text;
+    size_t newline = pos > 0 ? text.rfind('\n', pos - 1) : std::string::npos;
+    pos = newline == std::string::npos ? 0 : newline + 1;
+    if (pos >= text.size()) pos = 0;
+}
+
+// Types the watched corpus, moving to a new snapshot at the next key after it is published
+class WatchedSource : public TextSource {
+public:
+    explicit WatchedSource(CorpusWatcher& corpusWatcher) : watcher(corpusWatcher) {}
+
+    std::string_view next(size_t& n) override {
+        const std::shared_ptr<const CorpusSnapshot>& snapshot = watcher.latest();
+        if (snapshot->generation != generation) {
+            followSnapshot(*snapshot, file, pos);
+            generation = snapshot->generation;
+        }
+
+        size_t end = file->index.advance(pos, n);
+        std::string_view chunk = std::string_view(file->text).substr(pos, end - pos);
+        pos = end;
+        if (pos >= file->text.size()) {
+            pos = 0;
+        }
+        return chunk;
+    }
+
+    std::shared_ptr<const CorpusFile> file;   // The file being typed, kept alive while it is
+    size_t pos = 0;
+
+private:
+    CorpusWatcher& watcher;
+    uint64_t generation = 0;
+};
+#endif
+
+// Get executable directory
+std::string getExecutableDir() {
+    char result[PATH_MAX];
+    ssize_t count = readlink("/proc/self/exe", result, PATH_MAX);
+    if (count != -1) {
+        std::string path(result, count);
+        char* dir = dirname(&path[0]);
+        return std::string(dir);
+    }
+    return "."; // Fallback to current directory if we can't determine
+}
+
+// Function to find the hackertext files in the usual search paths
+std::vector<std::string> findHackerTextFiles(bool useCache, bool verbose) {
+    // Get the executable directory
+    std::string exeDir = getExecutableDir();
+    
+    // Define search paths in order of preference
+    std::vector<std::string> searchPaths = {
+        ".",                          // Current directory
+        exeDir,                       // Executable directory
+        "/usr/local/share/hackertyper", // System-wide data directory
+        "/usr/share/hackertyper"      // Alternative system-wide data directory
+    };
+    
+    std::vector<std::string> hackerTextFiles;
+    static const GlobPattern pattern = compileGlob("hackertext*.txt");
+
+    DiscoveryCache cache;
+    if (useCache) {
+        loadDiscoveryCache(cache);
+    }
+    
+    // Try each search path until we find files
+    for (const auto& path : searchPaths) {
+        hackerTextFiles = listMatchingFilesCached(path, pattern, useCache ? &cache : nullptr, verbose);
+        if (!hackerTextFiles.empty()) {
+            if (verbose) {
+                std::cout << "Found files in: " << path << std::endl;
+            }
+            break;
+        }
+    }
+    saveDiscoveryCache(cache);
+    
+    // If no files found, look for the original file in each path
+    if (hackerTextFiles.empty()) {
+        for (const auto& path : searchPaths) {
+            std::string originalFile = path + "/hackertext.txt";
+            std::ifstream test(originalFile);
+            if (test.good()) {
+                hackerTextFiles.push_back(originalFile);
+                if (verbose) {
+                    std::cout << "Using default file: " << originalFile << std::endl;
+                }
+                break;
+            }
+        }
+    }
+
+    return hackerTextFiles;
+}
+
+
+// Token classes from the highlighter; TOKEN_TEXT is the plain green look
+enum TokenClass : uint8_t {
+    TOKEN_TEXT,
+    TOKEN_KEYWORD,
+    TOKEN_NUMBER,
+    TOKEN_STRING,
+    TOKEN_COMMENT,
+    TOKEN_PREPROC,
+    TOKEN_CLASSES
+};
+
+// Character classes driving the lexer, one table lookup per byte
+enum CharClass : uint8_t {
+    CC_IDENT_START = 1,
+    CC_IDENT = 2,
+    CC_DIGIT = 4,
+    CC_SPACE = 8
+};
+
+struct CharClassTable {
+    uint8_t bits[256] = {};
+
+    CharClassTable() {
+        for (int c = 'a'; c <= 'z'; c++) bits[c] = CC_IDENT_START | CC_IDENT;
+        for (int c = 'A'; c <= 'Z'; c++) bits[c] = CC_IDENT_START | CC_IDENT;
+        for (int c = '0'; c <= '9'; c++) bits[c] = CC_IDENT | CC_DIGIT;
+        bits['_'] = CC_IDENT_START | CC_IDENT;
+        bits[' '] = bits['\t'] = bits['\r'] = CC_SPACE;
+    }
+};
+
+const CharClassTable kCharClasses;
+
+// Keywords of the languages the corpora are written in, in a small
+// open-addressing table keyed by a hash of the identifier
+struct KeywordTable {
+    static const size_t kSlots = 512;
+    std::string_view slots[kSlots];
+
+    static size_t hash(std::string_view word) {
+        size_t h = word.size();
+        for (char c : word) h = h * 31 + (unsigned char)c;
+        return h & (kSlots - 1);
+    }
+
+    KeywordTable() {
+        static const char* const words[] = {
+            // C and C++
+            "alignas", "auto", "bool", "break", "case", "catch", "char", "class", "const",
+            "constexpr", "continue", "default", "delete", "do", "double", "else", "enum",
+            "explicit", "extern", "false", "float", "for", "friend", "goto", "if", "inline",
+            "int", "long", "namespace", "new", "noexcept", "nullptr", "operator", "override",
+            "private", "protected", "public", "return", "short", "signed", "sizeof", "static",
+            "struct", "switch", "template", "this", "throw", "true", "try", "typedef",
+            "typename", "union", "unsigned", "using", "virtual", "void", "volatile", "while",
+            // Python
+            "and", "as", "assert", "async", "await", "def", "elif", "except", "finally", "from",
+            "global", "import", "in", "is", "lambda", "None", "not", "or", "pass", "raise",
+            "self", "True", "False", "with", "yield",
+            // JavaScript
+            "function", "let", "var", "require", "typeof", "instanceof", "of", "undefined",
+            // Shell
+            "then", "fi", "done", "esac", "local", "export", "echo"
+        };
+        for (const char* word : words) {
+            size_t slot = hash(word);
+            while (!slots[slot].empty()) slot = (slot + 1) & (kSlots - 1);
+            slots[slot] = word;
+        }
+    }
+
+    bool contains(std::string_view word) const {
+        for (size_t slot = hash(word); !slots[slot].empty(); slot = (slot + 1) & (kSlots - 1)) {
+            if (slots[slot] == word) return true;
+        }
+        return false;
+    }
+};
+
+const KeywordTable kKeywords;
+
+// Incremental lexer: classifies each revealed byte once, carrying its state
+// across keystrokes and lines. Keywords are only known once the identifier
+// ends, so those bytes are reported as text first and recoloured afterwards.
+struct Highlighter {
+    enum State : uint8_t {
+        NORMAL, IDENT, NUMBER, STRING, STRING_ESCAPE, QUOTE, QUOTE_ESCAPE,
+        SLASH, LINE_COMMENT, BLOCK_COMMENT, BLOCK_STAR, PREPROC
+    };
+
+    static const size_t kMaxIdent = 32;
+
+    State state = NORMAL;
+    bool lineStart = true;       // Only whitespace so far on this line
+    char ident[kMaxIdent];
+    size_t identLength = 0;
+
+    // Set by classify() when the last identLength bytes turned out to be a
+    // keyword (recolor = TOKEN_KEYWORD) or a slash opened a comment
+    size_t recolorLength = 0;
+    uint8_t recolor = TOKEN_TEXT;
+
+    uint8_t classify(unsigned char c) {
+        uint8_t bits = kCharClasses.bits[c];
+        recolorLength = 0;
+
+        switch (state) {
+        case IDENT:
+            if (bits & CC_IDENT) {
+                if (identLength < kMaxIdent) ident[identLength] = c;
+                identLength++;
+                return TOKEN_TEXT;
+            }
+            if (identLength <= kMaxIdent && kKeywords.contains(std::string_view(ident, identLength))) {
+                recolorLength = identLength;
+                recolor = TOKEN_KEYWORD;
+            }
+            state = NORMAL;
+            break;
+        case NUMBER:
+            if ((bits & CC_IDENT) || c == '.') return TOKEN_NUMBER;
+            state = NORMAL;
+            break;
+        case STRING:
+        case QUOTE:
+            if (c == '\n') {
+                state = NORMAL;  // Unterminated, give up at the end of the line
+                break;
+            }
+            if (c == '\\') state = state == STRING ? STRING_ESCAPE : QUOTE_ESCAPE;
+            else if (c == (state == STRING ? '"' : '\'')) state = NORMAL;
+            return TOKEN_STRING;
+        case STRING_ESCAPE:
+            state = STRING;
+            return TOKEN_STRING;
+        case QUOTE_ESCAPE:
+            state = QUOTE;
+            return TOKEN_STRING;
+        case SLASH:
+            if (c == '/' || c == '*') {
+                state = c == '/' ? LINE_COMMENT : BLOCK_COMMENT;
+                recolorLength = 1;
+                recolor = TOKEN_COMMENT;
+                return TOKEN_COMMENT;
+            }
+            state = NORMAL;
+            break;
+        case LINE_COMMENT:
+        case PREPROC:
+            if (c == '\n') {
+                state = NORMAL;
+                break;
+            }
+            return state == PREPROC ? TOKEN_PREPROC : TOKEN_COMMENT;
+        case BLOCK_COMMENT:
+            if (c == '*') state = BLOCK_STAR;
+            return TOKEN_COMMENT;
+        case BLOCK_STAR:
+            if (c == '/') state = NORMAL;
+            else if (c != '*') state = BLOCK_COMMENT;
+            return TOKEN_COMMENT;
+        case NORMAL:
+            break;
+        }
+
+        // NORMAL: start a new token
+        bool atLineStart = lineStart;
+        if (c == '\n') lineStart = true;
+        else if (!(bits & CC_SPACE)) lineStart = false;
+
+        if (bits & CC_IDENT_START) {
+            state = IDENT;
+            ident[0] = c;
+            identLength = 1;
+            return TOKEN_TEXT;
+        }
+        if (bits & CC_DIGIT) {
+            state = NUMBER;
+            return TOKEN_NUMBER;
+        }
+        switch (c) {
+        case '"':
+            state = STRING;
+            return TOKEN_STRING;
+        case '\'':
+            state = QUOTE;
+            return TOKEN_STRING;
+        case '/':
+            state = SLASH;
+            return TOKEN_TEXT;
+        case '#':
+            if (atLineStart) {
+                state = PREPROC;
+                return TOKEN_PREPROC;
+            }
+            return TOKEN_TEXT;
+        default:
+            return TOKEN_TEXT;
+        }
+    }
+};
+
+// Heap allocations, counted only while --stats is on. The flag is set once
+// at startup, so with it off every allocation pays a single predictable branch.
+bool countAllocations = false;
+std::atomic<unsigned long> allocationCount(0);
+
+void* operator new(size_t size) {
+    if (countAllocations) allocationCount.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+// Kept out of line: inlined into a caller, GCC sees free() applied to a
+// pointer from operator new and warns about a mismatch (-Wmismatched-new-delete)
+#if defined(__GNUC__)
+__attribute__((noinline))
+#elif defined(_MSC_VER)
+__declspec(noinline)
+#endif
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+// The other forms release through the plain one, so every pointer from the
+// operator new above goes back the same way
+void operator delete[](void* p) noexcept {
+    operator delete(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    operator delete(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    operator delete(p);
+}
+
+// Where finished frames go. flushFrame() hands each frame to the sink in
+// one call, so the renderer can run against a terminal, a file, nothing at
+// all or the in-memory terminal below without knowing which.
+struct OutputSink {
+    virtual ~OutputSink() {}
+
+    // Function to deliver one frame; returns the write calls it took
+    virtual unsigned long write(const char* data, size_t size) = 0;
+};
+
+// The terminal (or any descriptor, such as a pipe)
+struct TtySink : OutputSink {
+    int fd = 1;
+
+    unsigned long write(const char* data, size_t size) override {
+        #ifdef _WIN32
+        fwrite(data, 1, size, stdout);
+        fflush(stdout);
+        return 1;
+        #else
+        unsigned long calls = 0;
+        size_t written = 0;
+        while (written < size) {
+            ssize_t n = ::write(fd, data + written, size - written);
+            calls++;
+            if (n < 0) {
+                if (errno == EINTR || errno == EAGAIN) continue;
+                break;
+            }
+            written += n;
+        }
+        return calls;
+        #endif
+    }
+};
+
+// A file holding the raw escape stream, e.g. for --output
+struct FileSink : OutputSink {
+    FILE* file = nullptr;
+
+    bool open(const std::string& path) {
+        file = fopen(path.c_str(), "wb");
+        return file != nullptr;
+    }
+
+    unsigned long write(const char* data, size_t size) override {
+        fwrite(data, 1, size, file);
+        fflush(file);
+        return 1;
+    }
+
+    ~FileSink() {
+        if (file) fclose(file);
+    }
+};
+
+// Discards every frame; measures the renderer alone
+struct NullSink : OutputSink {
+    unsigned long write(const char*, size_t) override {
+        return 1;
+    }
+};
+
+// Colour of a VtCell: the terminal default, a palette index or 24-bit RGB
+const uint32_t kVtDefaultColor = 0xFFFFFFFF;
+const uint32_t kVtRgb = 0x01000000;
+
+// Style bits of a VtCell, numbered after their SGR codes 1-7
+enum VtStyle : uint8_t {
+    VT_BOLD = 1,
+    VT_DIM = 2,
+    VT_ITALIC = 4,
+    VT_UNDERLINE = 8,
+    VT_BLINK = 16,
+    VT_REVERSE = 64
+};
+
+// One character cell as a terminal shows it: glyph, colours and style.
+// The right half of a wide glyph is a placeholder with len 0.
+struct VtCell {
+    char glyph[8] = {' '};
+    uint8_t len = 1;
+    uint8_t style = 0;                // VT_BOLD etc.
+    uint32_t fg = kVtDefaultColor;    // Palette index, or kVtRgb | 0xRRGGBB
+    uint32_t bg = kVtDefaultColor;
+
+    bool operator==(const VtCell& other) const {
+        return len == other.len && style == other.style && fg == other.fg && bg == other.bg &&
+               memcmp(glyph, other.glyph, len) == 0;
+    }
+    bool operator!=(const VtCell& other) const { return !(*this == other); }
+};
+
+struct VtScreen;
+void vtFeed(VtScreen& vt, const char* data, size_t size);
+
+// In-memory VT100/xterm model: interprets the escape sequences this program
+// emits (cursor movement, erase, SGR colours, deferred wrap, scrolling) into
+// a grid of cells. Used for headless runs and for checking that two
+// renderers leave the terminal showing exactly the same thing.
+struct VtScreen : OutputSink {
+    enum ParseState { GROUND, ESCAPE, CSI };
+
+    int rows = 0;
+    int cols = 0;
+    std::vector<VtCell> cells;
+    int row = 0;
+    int col = 0;
+    bool pendingWrap = false;         // Last column written; the next glyph wraps
+    VtCell pen;                       // Style for new glyphs and erased cells
+    int savedRow = 0;
+    int savedCol = 0;
+    VtCell* lastCell = nullptr;       // Cell that zero-width glyphs extend
+    bool newlineReturns = true;       // LF also returns, like a tty with ONLCR
+    char partial[4];                  // UTF-8 sequence split across writes
+    size_t partialLength = 0;
+    size_t partialNeeded = 0;
+
+    ParseState state = GROUND;
+    int params[16];
+    int paramCount = 0;
+    bool privateMode = false;
+
+    unsigned long write(const char* data, size_t size) override {
+        vtFeed(*this, data, size);
+        return 1;
+    }
+};
+
+// Function to (re)size the model and blank it
+void vtResize(VtScreen& vt, int rows, int cols) {
+    vt.rows = std::max(rows, 1);
+    vt.cols = std::max(cols, 1);
+    vt.cells.assign(vt.rows * vt.cols, VtCell());
+    vt.row = vt.col = 0;
+    vt.pendingWrap = false;
+    vt.lastCell = nullptr;
+    vt.partialNeeded = 0;
+}
+
+// Function to blank cells [from, to) of the grid with the current background
+void vtErase(VtScreen& vt, size_t from, size_t to) {
+    VtCell blank;
+    blank.bg = vt.pen.bg;
+    std::fill(vt.cells.begin() + from, vt.cells.begin() + to, blank);
+}
+
+// Function to move down a line, scrolling the grid at the bottom
+void vtLineFeed(VtScreen& vt) {
+    if (vt.row + 1 < vt.rows) {
+        vt.row++;
+        return;
+    }
+    std::move(vt.cells.begin() + vt.cols, vt.cells.end(), vt.cells.begin());
+    vtErase(vt, vt.cells.size() - vt.cols, vt.cells.size());
+}
+
+// Function to apply an SGR sequence to the pen
+void vtSelectGraphics(VtScreen& vt) {
+    if (vt.paramCount == 0) vt.params[vt.paramCount++] = 0;
+    for (int k = 0; k < vt.paramCount; k++) {
+        int p = vt.params[k];
+        if (p == 0) {
+            vt.pen.style = 0;
+            vt.pen.fg = vt.pen.bg = kVtDefaultColor;
+        } else if (p >= 1 && p <= 7) {
+            vt.pen.style |= 1 << (p - 1);
+        } else if (p == 22) {
+            vt.pen.style &= ~(VT_BOLD | VT_DIM);
+        } else if (p >= 23 && p <= 27) {
+            vt.pen.style &= ~(1 << (p - 21));
+        } else if ((p == 38 || p == 48) && k + 1 < vt.paramCount) {
+            uint32_t color = kVtDefaultColor;
+            if (vt.params[k + 1] == 5 && k + 2 < vt.paramCount) {
+                color = vt.params[k + 2] & 255;
+                k += 2;
+            } else if (vt.params[k + 1] == 2 && k + 4 < vt.paramCount) {
+                color = kVtRgb | (vt.params[k + 2] & 255) << 16 | (vt.params[k + 3] & 255) << 8 | (vt.params[k + 4] & 255);
+                k += 4;
+            }
+            (p == 38 ? vt.pen.fg : vt.pen.bg) = color;
+        } else if (p >= 30 && p <= 37) {
+            vt.pen.fg = p - 30;
+        } else if (p == 39) {
+            vt.pen.fg = kVtDefaultColor;
+        } else if (p >= 40 && p <= 47) {
+            vt.pen.bg = p - 40;
+        } else if (p == 49) {
+            vt.pen.bg = kVtDefaultColor;
+        } else if (p >= 90 && p <= 97) {
+            vt.pen.fg = p - 90 + 8;
+        } else if (p >= 100 && p <= 107) {
+            vt.pen.bg = p - 100 + 8;
+        }
+    }
+}
+
+// Function to run a complete CSI sequence ending in the given byte
+void vtControlSequence(VtScreen& vt, char final) {
+    int first = vt.paramCount > 0 ? vt.params[0] : 0;
+    int count = std::max(first, 1);
+    if (vt.privateMode) return;       // Cursor visibility and other modes don't change cells
+
+    vt.pendingWrap = false;
+    switch (final) {
+    case 'A': vt.row = std::max(vt.row - count, 0); break;
+    case 'B': vt.row = std::min(vt.row + count, vt.rows - 1); break;
+    case 'C': vt.col = std::min(vt.col + count, vt.cols - 1); break;
+    case 'D': vt.col = std::max(vt.col - count, 0); break;
+    case 'G': vt.col = std::min(count, vt.cols) - 1; break;
+    case 'd': vt.row = std::min(count, vt.rows) - 1; break;
+    case 'H':
+    case 'f':
+        vt.row = std::min(count, vt.rows) - 1;
+        vt.col = std::min(vt.paramCount > 1 ? std::max(vt.params[1], 1) : 1, vt.cols) - 1;
+        break;
+    case 'J': {
+        size_t at = vt.row * vt.cols + vt.col;
+        if (first == 0) vtErase(vt, at, vt.cells.size());
+        else if (first == 1) vtErase(vt, 0, at + 1);
+        else vtErase(vt, 0, vt.cells.size());
+        break;
+    }
+    case 'K': {
+        size_t start = vt.row * vt.cols, at = start + vt.col;
+        if (first == 0) vtErase(vt, at, start + vt.cols);
+        else if (first == 1) vtErase(vt, start, at + 1);
+        else vtErase(vt, start, start + vt.cols);
+        break;
+    }
+    case 'm':
+        vtSelectGraphics(vt);
+        break;
+    }
+}
+
+// Function to put one glyph at the cursor. Zero-width glyphs join the one
+// before; a wide glyph that doesn't fit on the line wraps first, and
+// overwriting either half of a wide glyph blanks the other.
+void vtPrint(VtScreen& vt, const char* bytes, size_t length) {
+    size_t decoded;
+    int width = measureGlyph(bytes, length, 0, decoded);
+    if (decoded != length) width = 1;
+    if (width == 0) {
+        VtCell* cell = vt.lastCell;
+        if (cell && cell->len + length <= sizeof(cell->glyph)) {
+            memcpy(cell->glyph + cell->len, bytes, length);
+            cell->len += length;
+        }
+        return;
+    }
+    if (width > vt.cols) width = 1;
+    if (vt.pendingWrap || vt.col + width > vt.cols) {
+        vt.pendingWrap = false;
+        vt.col = 0;
+        vtLineFeed(vt);
+    }
+
+    VtCell* cells = &vt.cells[vt.row * vt.cols];
+    for (int c = vt.col; c < vt.col + width; c++) {
+        if (cells[c].len == 0 && c > 0) cells[c - 1] = VtCell();
+        if (c + 1 < vt.cols && cells[c + 1].len == 0) cells[c + 1] = VtCell();
+    }
+    VtCell& cell = cells[vt.col];
+    cell = vt.pen;
+    memcpy(cell.glyph, bytes, length);
+    cell.len = length;
+    if (width == 2) {
+        cells[vt.col + 1] = vt.pen;
+        cells[vt.col + 1].len = 0;
+    }
+    vt.lastCell = &cell;
+    if (vt.col + width < vt.cols) vt.col += width;
+    else vt.pendingWrap = true;
+}
+
+// Function to interpret a chunk of terminal output
+void vtFeed(VtScreen& vt, const char* data, size_t size) {
+    for (size_t k = 0; k < size; k++) {
+        unsigned char c = data[k];
+        switch (vt.state) {
+        case VtScreen::ESCAPE:
+            vt.state = VtScreen::GROUND;
+            if (c == '[') {
+                vt.state = VtScreen::CSI;
+                vt.paramCount = 0;
+                vt.privateMode = false;
+            } else if (c == '7') {
+                vt.savedRow = vt.row;
+                vt.savedCol = vt.col;
+            } else if (c == '8') {
+                vt.row = vt.savedRow;
+                vt.col = vt.savedCol;
+                vt.pendingWrap = false;
+            }
+            continue;
+        case VtScreen::CSI:
+            if (c >= '0' && c <= '9') {
+                if (vt.paramCount == 0) vt.params[vt.paramCount++] = 0;
+                int& p = vt.params[vt.paramCount - 1];
+                p = std::min(p * 10 + (c - '0'), 9999);
+            } else if (c == ';') {
+                if (vt.paramCount == 0) vt.params[vt.paramCount++] = 0;
+                if (vt.paramCount < 16) vt.params[vt.paramCount++] = 0;
+            } else if (c == '?' || c == '>' || c == '=') {
+                vt.privateMode = true;
+            } else if (c >= 0x40 && c <= 0x7e) {
+                vt.state = VtScreen::GROUND;
+                vtControlSequence(vt, c);
+            }
+            continue;
+        case VtScreen::GROUND:
+            break;
+        }
+
+        // Collect a multi-byte sequence, which may arrive in pieces
+        if (vt.partialNeeded > 0) {
+            if ((c & 0xC0) == 0x80) {
+                vt.partial[vt.partialLength++] = c;
+                if (vt.partialLength == vt.partialNeeded) {
+                    vt.partialNeeded = 0;
+                    vtPrint(vt, vt.partial, vt.partialLength);
+                }
+                continue;
+            }
+            // Cut short: show what came as it is
+            vt.partialNeeded = 0;
+            vtPrint(vt, vt.partial, vt.partialLength);
+        }
+
+        if (c == 0x1b) {
+            vt.state = VtScreen::ESCAPE;
+        } else if (c >= 0xC0 && c <= 0xF7) {
+            vt.partial[0] = c;
+            vt.partialLength = 1;
+            vt.partialNeeded = c < 0xE0 ? 2 : c < 0xF0 ? 3 : 4;
+            continue;
+        } else if (c >= 32 && c != 127) {
+            // Includes stray continuation bytes, shown on their own
+            char byte = c;
+            vtPrint(vt, &byte, 1);
+            continue;
+        } else if (c == '\r') {
+            vt.col = 0;
+            vt.pendingWrap = false;
+        } else if (c == '\n') {
+            if (vt.newlineReturns) vt.col = 0;
+            vt.pendingWrap = false;
+            vtLineFeed(vt);
+        } else if (c == '\b') {
+            if (vt.col > 0) vt.col--;
+            vt.pendingWrap = false;
+        } else if (c == '\t') {
+            vt.col = std::min((vt.col / 8 + 1) * 8, vt.cols - 1);
+        }
+        vt.lastCell = nullptr;
+    }
+}
+
+// Function to give the model's screen as text, one line per row with
+// trailing blanks dropped
+std::string vtText(const VtScreen& vt) {
+    std::string text;
+    for (int r = 0; r < vt.rows; r++) {
+        size_t lineStart = text.size(), end = text.size();
+        for (int c = 0; c < vt.cols; c++) {
+            const VtCell& cell = vt.cells[r * vt.cols + c];
+            if (cell.len == 0) continue;
+            text.append(cell.glyph, cell.len);
+            if (cell.len != 1 || cell.glyph[0] != ' ') end = text.size();
+        }
+        text.resize(std::max(end, lineStart));
+        text += '\n';
+    }
+    return text;
+}
+
+// Function to compare what two cells look like: a blank shows only its
+// background, so the foreground and weight it was erased with don't matter
+bool vtSameLook(const VtCell& a, const VtCell& b) {
+    if (a == b) return true;
+    auto blank = [](const VtCell& cell) {
+        return cell.len == 1 && cell.glyph[0] == ' ' && !(cell.style & (VT_UNDERLINE | VT_REVERSE));
+    };
+    return blank(a) && blank(b) && a.bg == b.bg;
+}
+
+// Function to find the first cell where two models look different; false
+// if the screens are identical (same size, glyphs, colours and styles)
+bool vtFirstDifference(const VtScreen& a, const VtScreen& b, int& row, int& col) {
+    row = col = 0;
+    if (a.rows != b.rows || a.cols != b.cols) return true;
+    for (size_t k = 0; k < a.cells.size(); k++) {
+        if (!vtSameLook(a.cells[k], b.cells[k])) {
+            row = k / a.cols;
+            col = k % a.cols;
+            return true;
+        }
+    }
+    return false;
+}
+
+TtySink ttySink;
+
+// Collects all text, colour codes and cursor escapes for one frame so the
+// frame reaches the sink in a single write
+struct FrameBuffer {
+    std::string data;
+    OutputSink* sink = &ttySink;
+
+    // Totals for --io-stats
+    unsigned long frames = 0;
+    unsigned long syscalls = 0;
+    unsigned long long bytes = 0;
+    unsigned long maxFrameSyscalls = 0;
+    size_t maxFrameBytes = 0;
+
+    // For --stats: time spent in write() for the last frame
+    bool timeWrites = false;
+    std::chrono::steady_clock::duration lastWriteTime{};
+};
+
+FrameBuffer out;
+
+FrameBuffer& operator<<(FrameBuffer& buf, const std::string& text) {
+    buf.data += text;
+    return buf;
+}
+
+FrameBuffer& operator<<(FrameBuffer& buf, const char* text) {
+    buf.data += text;
+    return buf;
+}
+
+FrameBuffer& operator<<(FrameBuffer& buf, char c) {
+    buf.data += c;
+    return buf;
+}
+
+FrameBuffer& operator<<(FrameBuffer& buf, int value) {
+    char digits[16];
+    int n = snprintf(digits, sizeof(digits), "%d", value);
+    buf.data.append(digits, n);
+    return buf;
+}
+
+// Function to send the pending frame to the terminal
+void flushFrame() {
+    if (out.data.empty()) return;
+
+    std::chrono::steady_clock::time_point writeStart;
+    if (out.timeWrites) writeStart = std::chrono::steady_clock::now();
+    unsigned long frameSyscalls = out.sink->write(out.data.data(), out.data.size());
+
+    if (out.timeWrites) out.lastWriteTime = std::chrono::steady_clock::now() - writeStart;
+    out.frames++;
+    out.syscalls += frameSyscalls;
+    out.bytes += out.data.size();
+    out.maxFrameSyscalls = std::max(out.maxFrameSyscalls, frameSyscalls);
+    out.maxFrameBytes = std::max(out.maxFrameBytes, out.data.size());
+    out.data.clear();
+}
+
+// Function to print the output counters collected by flushFrame()
+void reportFrameStats() {
+    if (out.frames == 0) return;
+    std::cerr << "frames: " << out.frames
+              << ", write syscalls: " << out.syscalls
+              << " (" << (double)out.syscalls / out.frames << "/frame, max " << out.maxFrameSyscalls << ")"
+              << ", bytes: " << out.bytes
+              << " (" << out.bytes / out.frames << "/frame, max " << out.maxFrameBytes << ")" << std::endl;
+}
+
+#ifndef _WIN32
+// Colour/attribute of a screen cell; indexes the theme tables
+enum Attr : uint8_t {
+    ATTR_RESET,
+    ATTR_GRAY,
+    ATTR_GREEN,
+    ATTR_RED,
+    ATTR_KEYWORD,
+    ATTR_NUMBER,
+    ATTR_STRING,
+    ATTR_COMMENT,
+    ATTR_PREPROC,
+    ATTR_COUNT
+};
+
+// How an attribute looks: a foreground colour in the VtCell encoding
+// (default, palette index or kVtRgb | 0xRRGGBB) and its weight
+struct ThemeColor {
+    uint32_t color;
+    bool bold;
+};
+
+struct Theme {
+    const char* name;
+    ThemeColor attrs[ATTR_COUNT];
+};
+
+// Selectable with --theme. Palette indexes below 16 are sent as the classic
+// SGR 30-37/90-97 codes, higher ones as 256-colour codes.
+const Theme kThemes[] = {
+    // The original MS-DOS look: light gray chrome, bright green text
+    { "dos", { { kVtDefaultColor, false }, { 7, false }, { 2, true }, { 1, true }, { 7, true },
+               { 6, true }, { 3, true }, { 2, false }, { 5, true } } },
+    // 16 colours without bold, for terminals that don't brighten bold text
+    { "ansi", { { kVtDefaultColor, false }, { 7, false }, { 10, false }, { 9, false }, { 15, false },
+                { 14, false }, { 11, false }, { 2, false }, { 13, false } } },
+    // Green phosphor shades from the 256-colour cube
+    { "256", { { kVtDefaultColor, false }, { 249, false }, { 46, false }, { 196, true }, { 157, true },
+               { 49, false }, { 154, false }, { 28, false }, { 120, false } } },
+    // 24-bit colour CRT palette
+    { "truecolor", { { kVtDefaultColor, false }, { kVtRgb | 0xb8c4b8, false }, { kVtRgb | 0x33ff66, false },
+                     { kVtRgb | 0xff4040, true }, { kVtRgb | 0xd8ffe0, true }, { kVtRgb | 0x5ee7ff, false },
+                     { kVtRgb | 0xffd866, false }, { kVtRgb | 0x2e8b57, false }, { kVtRgb | 0xff79c6, false } } }
+};
+
+// Escape tables for the current theme, built once by loadTheme().
+// attrCodes[a] sets attribute a from any state; attrTransitions[a][b] is
+// the shortest change from a to b, empty when they look the same.
+std::string attrCodes[ATTR_COUNT];
+std::string attrTransitions[ATTR_COUNT][ATTR_COUNT];
+
+// Function to append the SGR parameter selecting a foreground colour
+void appendColorParam(std::string& params, uint32_t color) {
+    char digits[24];
+    if (color == kVtDefaultColor) {
+        snprintf(digits, sizeof(digits), "39");
+    } else if (color & kVtRgb) {
+        snprintf(digits, sizeof(digits), "38;2;%u;%u;%u", (color >> 16) & 255, (color >> 8) & 255, color & 255);
+    } else if (color < 8) {
+        snprintf(digits, sizeof(digits), "%u", 30 + color);
+    } else if (color < 16) {
+        snprintf(digits, sizeof(digits), "%u", 90 + color - 8);
+    } else {
+        snprintf(digits, sizeof(digits), "38;5;%u", color);
+    }
+    if (!params.empty()) params += ';';
+    params += digits;
+}
+
+// Function to work out the SGR parameters that turn one look into another
+std::string sgrParams(const ThemeColor& from, const ThemeColor& to) {
+    std::string params;
+    if (from.bold != to.bold) params = to.bold ? "1" : "22";
+    if (from.color != to.color) appendColorParam(params, to.color);
+    return params;
+}
+
+// Function to precompute every escape string for a theme
+void loadTheme(const Theme& theme) {
+    const ThemeColor& plain = theme.attrs[ATTR_RESET];
+    for (int a = 0; a < ATTR_COUNT; a++) {
+        std::string params = sgrParams(plain, theme.attrs[a]);
+        attrCodes[a] = "\033[0" + (params.empty() ? "" : ";" + params) + "m";
+        for (int b = 0; b < ATTR_COUNT; b++) {
+            if (b == ATTR_RESET) {
+                // Returning to plain text is always a full reset
+                attrTransitions[a][b] = a == b ? "" : attrCodes[ATTR_RESET];
+                continue;
+            }
+            params = sgrParams(theme.attrs[a], theme.attrs[b]);
+            attrTransitions[a][b] = params.empty() ? "" : "\033[" + params + "m";
+        }
+    }
+}
+
+// The default look is ready before main() runs, also for the benchmarks
+const bool defaultThemeLoaded = (loadTheme(kThemes[0]), true);
+
+// Function to find a theme by name; null if there is none
+const Theme* findTheme(const std::string& name) {
+    for (const Theme& theme : kThemes) {
+        if (name == theme.name) return &theme;
+    }
+    return nullptr;
+}
+
+// Function to get the escape that switches the terminal from attribute
+// `from` (-1 if unknown) to `to`
+const std::string& sgrTransition(int from, uint8_t to) {
+    return from < 0 ? attrCodes[to] : attrTransitions[from][to];
+}
+
+// Attribute for each TokenClass
+const uint8_t kTokenAttrs[TOKEN_CLASSES] = {
+    ATTR_GREEN, ATTR_KEYWORD, ATTR_NUMBER, ATTR_STRING, ATTR_COMMENT, ATTR_PREPROC
+};
+
+// One character cell: a UTF-8 glyph plus its attribute. A wide glyph takes
+// two cells; the right one is a placeholder with len 0.
+struct Cell {
+    char glyph[8] = {' '};
+    uint8_t len = 1;
+    uint8_t attr = ATTR_RESET;
+
+    bool operator==(const Cell& other) const {
+        return len == other.len && attr == other.attr &&
+               memcmp(glyph, other.glyph, len) == 0;
+    }
+    bool operator!=(const Cell& other) const { return !(*this == other); }
+};
+
+// Double-buffered screen model. Everything is drawn into the back grid;
+// screenPresent() compares it with the front grid (what the terminal shows)
+// and emits cursor moves and glyphs only for the cells that changed.
+struct Screen {
+    int rows = 0;
+    int cols = 0;
+    std::vector<Cell> front;
+    std::vector<Cell> back;
+    std::vector<char> dirty;      // Rows of the back grid touched since the last present
+
+    int cursorRow = 0;            // Write position in the back grid
+    int cursorCol = 0;
+    uint8_t attr = ATTR_RESET;    // Attribute for new writes
+    Cell* lastCell = nullptr;     // Cell that UTF-8 continuation bytes extend
+
+    bool repaint = true;          // Terminal contents unknown, clear and redraw
+    bool cleared = false;         // Back grid was cleared since the last present
+    int pendingScroll = 0;        // Lines the back grid scrolled since the last present
+
+    int termRow = -1;             // Terminal cursor and attribute, -1 if unknown
+    int termCol = -1;
+    int termAttr = -1;
+
+    std::string overlay;          // Drawn over the right of the bottom row, not part of the grid
+    std::vector<Cell> underOverlay;
+};
+
+Screen screen;
+
+// Function to (re)size the screen; the next present repaints everything
+void screenResize(Screen& s, int rows, int cols) {
+    s.rows = rows;
+    s.cols = cols;
+    s.front.assign(rows * cols, Cell());
+    s.back.assign(rows * cols, Cell());
+    s.dirty.assign(rows, 1);
+    s.cursorRow = std::min(s.cursorRow, rows - 1);
+    s.cursorCol = std::min(s.cursorCol, cols - 1);
+    s.lastCell = nullptr;
+    s.repaint = true;
+    s.pendingScroll = 0;
+}
+
+// Function to blank the back grid and home the write position
+void screenClear(Screen& s) {
+    std::fill(s.back.begin(), s.back.end(), Cell());
+    std::fill(s.dirty.begin(), s.dirty.end(), 1);
+    s.cursorRow = 0;
+    s.cursorCol = 0;
+    s.lastCell = nullptr;
+    s.cleared = true;
+    s.pendingScroll = 0;
+}
+
+// Function to scroll the back grid up by n lines
+void screenScroll(Screen& s, int n) {
+    if (n <= 0) return;
+    n = std::min(n, s.rows);
+    std::move(s.back.begin() + n * s.cols, s.back.end(), s.back.begin());
+    std::fill(s.back.end() - n * s.cols, s.back.end(), Cell());
+    std::fill(s.dirty.begin(), s.dirty.end(), 1);
+    s.lastCell = nullptr;
+
+    // A cleared grid is repainted from scratch anyway
+    if (!s.cleared) s.pendingScroll += n;
+}
+
+// Function to change the attribute of the n cells written last
+void screenRecolor(Screen& s, size_t n, uint8_t attr) {
+    int row = s.cursorRow, col = s.cursorCol;
+    while (n-- > 0) {
+        if (--col < 0) {
+            if (--row < 0) return;
+            col = s.cols - 1;
+        }
+        s.back[row * s.cols + col].attr = attr;
+        s.dirty[row] = 1;
+    }
+}
+
+// Function to move the write position
+void screenMove(Screen& s, int row, int col) {
+    s.cursorRow = std::max(0, std::min(row, s.rows - 1));
+    s.cursorCol = std::max(0, std::min(col, s.cols - 1));
+    s.lastCell = nullptr;
+}
+
+// Function to add a zero-width glyph (combining mark, joiner, variation
+// selector) to the cell written before it, if it fits
+void extendLastCell(Screen& s, const char* bytes, size_t length) {
+    Cell* cell = s.lastCell;
+    if (cell && cell->len + length <= sizeof(cell->glyph)) {
+        memcpy(cell->glyph + cell->len, bytes, length);
+        cell->len += length;
+    }
+}
+
+// Function to put a glyph into the cell at (row, col) of the back grid,
+// with a placeholder to its right when it is wide. Whatever wide glyph the
+// cells were part of is blanked so no half of it is left behind.
+void putGlyph(Screen& s, int row, int col, const char* bytes, size_t length, int width) {
+    Cell* cells = &s.back[row * s.cols];
+    for (int c = col; c < col + width; c++) {
+        if (cells[c].len == 0 && c > 0) cells[c - 1] = Cell();
+        if (c + 1 < s.cols && cells[c + 1].len == 0) cells[c + 1] = Cell();
+    }
+    Cell& cell = cells[col];
+    memcpy(cell.glyph, bytes, length);
+    cell.len = length;
+    cell.attr = s.attr;
+    if (width == 2) {
+        cells[col + 1].len = 0;
+        cells[col + 1].attr = s.attr;
+    }
+    s.dirty[row] = 1;
+    s.lastCell = &cell;
+}
+
+// Function to write text at the write position, wrapping and scrolling like a terminal
+void screenWrite(Screen& s, const char* text, size_t n) {
+    for (size_t k = 0; k < n; k++) {
+        unsigned char c = text[k];
+
+        // UTF-8 continuation bytes belong to the glyph just written
+        if ((c & 0xC0) == 0x80) {
+            extendLastCell(s, text + k, 1);
+            continue;
+        }
+
+        if (c < 32) s.lastCell = nullptr;
+        if (c == '\n') {
+            s.cursorCol = 0;
+            if (s.cursorRow == s.rows - 1) {
+                screenScroll(s, 1);
+            } else {
+                s.cursorRow++;
+            }
+            continue;
+        }
+        if (c == '\r') {
+            s.cursorCol = 0;
+            continue;
+        }
+        if (c == '\b') {
+            if (s.cursorCol > 0) s.cursorCol--;
+            continue;
+        }
+        if (c == '\t') {
+            for (int stop = tabStop(s.cursorCol, s.cols); s.cursorCol < stop; s.cursorCol++) {
+                putGlyph(s, s.cursorRow, s.cursorCol, " ", 1, 1);
+            }
+            s.lastCell = nullptr;
+            continue;
+        }
+        if (c < 32) continue;
+
+        size_t length;
+        int width = measureGlyph(text, n, k, length);
+        if (width == 0) {
+            extendLastCell(s, text + k, length);
+            k += length - 1;
+            continue;
+        }
+        if (width > s.cols) width = 1;
+
+        if (s.cursorCol + width > s.cols) {
+            s.cursorCol = 0;
+            if (s.cursorRow == s.rows - 1) {
+                screenScroll(s, 1);
+            } else {
+                s.cursorRow++;
+            }
+        }
+
+        putGlyph(s, s.cursorRow, s.cursorCol, text + k, length, width);
+        s.cursorCol += width;
+        k += length - 1;
+    }
+}
+
+// Function to move the terminal cursor, picking the shortest sequence
+void emitMove(Screen& s, FrameBuffer& buf, int row, int col) {
+    if (row == s.termRow && col == s.termCol) return;
+
+    if (row == s.termRow && col == 0) {
+        buf << '\r';
+    } else if (row == s.termRow && col < s.termCol && s.termCol - col <= 4) {
+        for (int c = col; c < s.termCol; c++) buf << '\b';
+    } else if (row == s.termRow && s.termCol >= 0 && col > s.termCol && col - s.termCol <= 4) {
+        // Re-sending a few unchanged cells is cheaper than addressing
+        const Cell* cells = &s.front[row * s.cols];
+        bool plain = true;
+        for (int c = s.termCol; c < col; c++) {
+            if (cells[c].attr != s.termAttr || cells[c].len != 1) plain = false;
+        }
+        if (plain) {
+            for (int c = s.termCol; c < col; c++) buf << cells[c].glyph[0];
+        } else {
+            buf << "\033[" << (col - s.termCol) << "C";
+        }
+    } else {
+        buf << "\033[" << row + 1 << ";" << col + 1 << "H";
+    }
+    s.termRow = row;
+    s.termCol = col;
+}
+
+// Function to emit the difference between the back and front grids
+void screenPresent(Screen& s, FrameBuffer& buf) {
+    if (s.cleared && !s.repaint) {
+        // After a clear, wipe the terminal only if most cells would change anyway
+        size_t changed = 0;
+        for (size_t k = 0; k < s.back.size(); k++) {
+            if (s.back[k] != s.front[k]) changed++;
+        }
+        s.repaint = changed > s.back.size() / 2;
+    }
+    if (s.pendingScroll >= s.rows) {
+        // Everything scrolled off; nothing on the terminal can be reused
+        s.repaint = true;
+    }
+
+    if (s.repaint) {
+        buf << attrCodes[ATTR_RESET] << "\033[H\033[2J";
+        std::fill(s.front.begin(), s.front.end(), Cell());
+        s.termRow = 0;
+        s.termCol = 0;
+        s.termAttr = ATTR_RESET;
+    } else if (s.pendingScroll > 0) {
+        // Let the terminal scroll instead of redrawing every row
+        if (s.termAttr != ATTR_RESET) {
+            buf << attrCodes[ATTR_RESET];
+            s.termAttr = ATTR_RESET;
+        }
+        buf << "\033[" << s.rows << ";1H";
+        for (int k = 0; k < s.pendingScroll; k++) buf << '\n';
+        std::move(s.front.begin() + s.pendingScroll * s.cols, s.front.end(), s.front.begin());
+        std::fill(s.front.end() - s.pendingScroll * s.cols, s.front.end(), Cell());
+        s.termRow = s.rows - 1;
+        s.termCol = 0;
+    }
+    s.repaint = false;
+    s.cleared = false;
+    s.pendingScroll = 0;
+
+    // Stamp the overlay onto the bottom row for this frame only
+    int overlayRow = s.rows - 1;
+    int overlayWidth = std::min((int)s.overlay.size(), s.cols);
+    Cell* overlayCells = &s.back[overlayRow * s.cols + s.cols - overlayWidth];
+    s.underOverlay.assign(overlayCells, overlayCells + overlayWidth);
+    for (int k = 0; k < overlayWidth; k++) {
+        overlayCells[k] = Cell();
+        overlayCells[k].glyph[0] = s.overlay[k];
+        overlayCells[k].attr = ATTR_GRAY;
+    }
+    if (overlayWidth > 0) s.dirty[overlayRow] = 1;
+
+    for (int r = 0; r < s.rows; r++) {
+        if (!s.dirty[r]) continue;
+        s.dirty[r] = 0;
+
+        for (int c = 0; c < s.cols; c++) {
+            const Cell& want = s.back[r * s.cols + c];
+            Cell& have = s.front[r * s.cols + c];
+            if (want == have) continue;
+            if (want.len == 0) {
+                // Right half of a wide glyph: drawn with its left half
+                have = want;
+                continue;
+            }
+
+            emitMove(s, buf, r, c);
+            if (want.attr != s.termAttr) {
+                buf << sgrTransition(s.termAttr, want.attr);
+                s.termAttr = want.attr;
+            }
+            buf.data.append(want.glyph, want.len);
+            have = want;
+
+            // Writing the last column leaves the cursor in a pending-wrap state
+            int width = (c + 1 < s.cols && s.back[r * s.cols + c + 1].len == 0) ? 2 : 1;
+            s.termCol = (c + width < s.cols) ? c + width : -1;
+        }
+    }
+
+    // Put back what the overlay covers; the row is compared again next frame
+    if (overlayWidth > 0) {
+        std::copy(s.underOverlay.begin(), s.underOverlay.end(), overlayCells);
+        s.dirty[overlayRow] = 1;
+    }
+
+    // Park the terminal cursor at the write position
+    emitMove(s, buf, std::min(s.cursorRow, s.rows - 1), std::min(s.cursorCol, s.cols - 1));
+}
+
+// A rectangle of the screen with its own write position, colour and
+// scrolling, so several live feeds can share the grid without overwriting
+// each other. The grid stays the one compositor: panes only write cells,
+// and screenPresent() sends the frame.
+struct Pane {
+    int top = 0;
+    int left = 0;
+    int rows = 1;
+    int cols = 1;
+    int cursorRow = 0;
+    int cursorCol = 0;
+    uint8_t attr = ATTR_RESET;
+};
+
+// Pane that console output goes to; null for the whole screen
+Pane* activePane = nullptr;
+
+Cell& paneCell(Screen& s, const Pane& p, int row, int col) {
+    return s.back[(p.top + row) * s.cols + p.left + col];
+}
+
+// A pane squeezed out by a tiny screen has no cells; writes to it are dropped
+bool paneEmpty(const Pane& p) {
+    return p.rows <= 0 || p.cols <= 0;
+}
+
+// Function to scroll a pane up by one line inside its own rectangle
+void paneScroll(Screen& s, Pane& p) {
+    for (int r = 0; r + 1 < p.rows; r++) {
+        const Cell* below = &paneCell(s, p, r + 1, 0);
+        std::copy(below, below + p.cols, &paneCell(s, p, r, 0));
+        s.dirty[p.top + r] = 1;
+    }
+    std::fill_n(&paneCell(s, p, p.rows - 1, 0), p.cols, Cell());
+    s.dirty[p.top + p.rows - 1] = 1;
+    s.lastCell = nullptr;
+}
+
+void paneClear(Screen& s, Pane& p) {
+    p.cursorRow = 0;
+    p.cursorCol = 0;
+    if (paneEmpty(p)) return;
+    for (int r = 0; r < p.rows; r++) {
+        std::fill_n(&paneCell(s, p, r, 0), p.cols, Cell());
+        s.dirty[p.top + r] = 1;
+    }
+    s.lastCell = nullptr;
+}
+
+// Function to write text into a pane, wrapping and scrolling at its edges
+void paneWrite(Screen& s, Pane& p, const char* text, size_t n) {
+    if (paneEmpty(p)) return;
+    for (size_t k = 0; k < n; k++) {
+        unsigned char c = text[k];
+
+        // UTF-8 continuation bytes belong to the glyph just written
+        if ((c & 0xC0) == 0x80) {
+            extendLastCell(s, text + k, 1);
+            continue;
+        }
+
+        size_t length = 1;
+        int width = c < 32 ? 0 : measureGlyph(text, n, k, length);
+        if (c >= 32 && width == 0) {
+            extendLastCell(s, text + k, length);
+            k += length - 1;
+            continue;
+        }
+        if (width > p.cols) width = 1;
+
+        s.lastCell = nullptr;
+        if (c == '\n' || (c >= 32 && p.cursorCol + width > p.cols)) {
+            p.cursorCol = 0;
+            if (p.cursorRow == p.rows - 1) {
+                paneScroll(s, p);
+            } else {
+                p.cursorRow++;
+            }
+            if (c == '\n') continue;
+        }
+        if (c == '\r') {
+            p.cursorCol = 0;
+            continue;
+        }
+        if (c == '\b') {
+            if (p.cursorCol > 0) p.cursorCol--;
+            continue;
+        }
+        if (c == '\t') {
+            for (int stop = tabStop(p.cursorCol, p.cols); p.cursorCol < stop; p.cursorCol++) {
+                putGlyph(s, p.top + p.cursorRow, p.left + p.cursorCol, " ", 1, 1);
+            }
+            s.lastCell = nullptr;
+            continue;
+        }
+        if (c < 32) continue;
+
+        putGlyph(s, p.top + p.cursorRow, p.left + p.cursorCol, text + k, length, width);
+        p.cursorCol += width;
+        k += length - 1;
+    }
+}
+
+// Function to change the attribute of the n cells last written into a pane
+void paneRecolor(Screen& s, Pane& p, size_t n, uint8_t attr) {
+    if (paneEmpty(p)) return;
+    int row = p.cursorRow, col = p.cursorCol;
+    while (n-- > 0) {
+        if (--col < 0) {
+            if (--row < 0) return;
+            col = p.cols - 1;
+        }
+        paneCell(s, p, row, col).attr = attr;
+        s.dirty[p.top + row] = 1;
+    }
+}
+
+// Function to send console output to a pane (null: the whole screen); each
+// pane keeps its own colour across switches
+void selectPane(Pane* pane) {
+    if (activePane) activePane->attr = screen.attr;
+    activePane = pane;
+    if (pane) screen.attr = pane->attr;
+}
+#endif
+
+// Cross-platform functions for terminal handling
+#ifdef _WIN32
+// Windows version
+void setupTerminal() {
+    // Nothing needed for Windows
+}
+
+void resetTerminal() {
+    // Nothing needed for Windows
+}
+
+bool kbhit() {
+    return _kbhit();
+}
+
+char getch() {
+    return _getch();
+}
+
+bool stdinClosed = false;
+
+size_t readKeys(char* keys, size_t capacity) {
+    size_t n = 0;
+    while (n < capacity && _kbhit()) {
+        keys[n++] = _getch();
+    }
+    return n;
+}
+
+void sleep_ms(int ms) {
+    Sleep(ms);
+}
+
+void clearScreen() {
+    flushFrame();
+    system("cls");
+}
+
+void getTerminalSize(int& rows, int& cols) {
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    rows = 24;
+    cols = 80;
+    if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info)) {
+        rows = info.srWindow.Bottom - info.srWindow.Top + 1;
+        cols = info.srWindow.Right - info.srWindow.Left + 1;
+    }
+}
+
+// Console attribute last set, so repeated colour changes cost nothing
+int consoleColor = -1;
+
+void setTextColor(int color) {
+    if (color == consoleColor) return;
+    consoleColor = color;
+
+    // Console attributes apply immediately, so send what came before first
+    flushFrame();
+    HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
+    SetConsoleTextAttribute(hConsole, color);
+}
+
+void setGreenText() {
+    setTextColor(FOREGROUND_GREEN | FOREGROUND_INTENSITY);
+}
+
+void setGrayText() {
+    setTextColor(FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE | FOREGROUND_INTENSITY);
+}
+
+void setRedText() {
+    setTextColor(FOREGROUND_RED | FOREGROUND_INTENSITY);
+}
+
+void setTokenColor(uint8_t token) {
+    static const int colors[TOKEN_CLASSES] = {
+        FOREGROUND_GREEN | FOREGROUND_INTENSITY,                                       // TOKEN_TEXT
+        FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE | FOREGROUND_INTENSITY,    // TOKEN_KEYWORD
+        FOREGROUND_GREEN | FOREGROUND_BLUE | FOREGROUND_INTENSITY,                      // TOKEN_NUMBER
+        FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_INTENSITY,                       // TOKEN_STRING
+        FOREGROUND_GREEN,                                                              // TOKEN_COMMENT
+        FOREGROUND_RED | FOREGROUND_BLUE | FOREGROUND_INTENSITY                        // TOKEN_PREPROC
+    };
+    setTextColor(colors[token]);
+}
+
+void recolorLast(size_t, uint8_t) {
+    // Already on the console; keywords keep the text colour until a redraw
+}
+
+void resetTextColor() {
+    setTextColor(FOREGROUND_RED | FOREGROUND_GREEN | FOREGROUND_BLUE);
+}
+
+void consoleWrite(const char* text, size_t n) {
+    out.data.append(text, n);
+}
+
+void moveCursor(int row, int col) {
+    out << "\033[" << row << ";" << col << "H";
+}
+
+void presentFrame() {
+    flushFrame();
+}
+
+// Panes need the screen grid; here all output goes to the console
+struct Pane {};
+Pane* activePane = nullptr;
+
+void selectPane(Pane*) {}
+
+#else
+// Linux/Unix version
+struct termios oldSettings, newSettings;
+
+void setupTerminal() {
+    tcgetattr(fileno(stdin), &oldSettings);
+    newSettings = oldSettings;
+    newSettings.c_lflag &= (~ICANON & ~ECHO & ~ISIG); // Ctrl+C arrives as a key
+    tcsetattr(fileno(stdin), TCSANOW, &newSettings);
+}
+
+void resetTerminal() {
+    tcsetattr(fileno(stdin), TCSANOW, &oldSettings);
+}
+
+bool kbhit() {
+    fd_set readfds;
+    struct timeval tv;
+    
+    FD_ZERO(&readfds);
+    FD_SET(STDIN_FILENO, &readfds);
+    
+    tv.tv_sec = 0;
+    tv.tv_usec = 1000;
+    
+    return select(STDIN_FILENO + 1, &readfds, NULL, NULL, &tv) > 0;
+}
+
+char getch() {
+    char buf = 0;
+    if (read(STDIN_FILENO, &buf, 1) > 0) {
+        return buf;
+    }
+    return 0;
+}
+
+// Set once stdin reaches end of file
+bool stdinClosed = false;
+
+// Function to drain every byte that is already waiting, in one read
+size_t readKeys(char* keys, size_t capacity) {
+    ssize_t n = read(STDIN_FILENO, keys, capacity);
+    if (n == 0) {
+        stdinClosed = true;
+    }
+    return n > 0 ? n : 0;
+}
+
+void sleep_ms(int ms) {
+    usleep(ms * 1000);
+}
+
+void clearScreen() {
+    if (activePane) {
+        paneClear(screen, *activePane);
+    } else {
+        screenClear(screen);
+    }
+}
+
+void getTerminalSize(int& rows, int& cols) {
+    struct winsize ws;
+    rows = 24;
+    cols = 80;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0) {
+        rows = ws.ws_row;
+        cols = ws.ws_col;
+    }
+}
+
+void setGreenText() {
+    screen.attr = ATTR_GREEN; // Bright green
+}
+
+void setGrayText() {
+    screen.attr = ATTR_GRAY; // Light gray
+}
+
+void setRedText() {
+    screen.attr = ATTR_RED; // Bright red
+}
+
+void setTokenColor(uint8_t token) {
+    screen.attr = kTokenAttrs[token];
+}
+
+// Function to change the colour of the last n characters written
+void recolorLast(size_t n, uint8_t token) {
+    if (activePane) {
+        paneRecolor(screen, *activePane, n, kTokenAttrs[token]);
+    } else {
+        screenRecolor(screen, n, kTokenAttrs[token]);
+    }
+}
+
+void resetTextColor() {
+    screen.attr = ATTR_RESET;
+}
+
+void consoleWrite(const char* text, size_t n) {
+    if (activePane) {
+        paneWrite(screen, *activePane, text, n);
+    } else {
+        screenWrite(screen, text, n);
+    }
+}
+
+void moveCursor(int row, int col) {
+    // Rows and columns are 1-based like the escape sequences they replace
+    if (activePane) {
+        activePane->cursorRow = std::max(0, std::min(row - 1, activePane->rows - 1));
+        activePane->cursorCol = std::max(0, std::min(col - 1, activePane->cols - 1));
+        screen.lastCell = nullptr;
+    } else {
+        screenMove(screen, row - 1, col - 1);
+    }
+}
+
+// Function to draw the pending changes to the terminal
+void presentFrame() {
+    screenPresent(screen, out);
+    flushFrame();
+}
+#endif
+
+// Drawing target of the UI code: the screen grid on Linux, the raw frame
+// buffer on Windows
+struct Console {};
+
+Console term;
+
+Console& operator<<(Console& con, const std::string& text) {
+    consoleWrite(text.data(), text.size());
+    return con;
+}
+
+Console& operator<<(Console& con, const char* text) {
+    consoleWrite(text, strlen(text));
+    return con;
+}
+
+Console& operator<<(Console& con, char c) {
+    consoleWrite(&c, 1);
+    return con;
+}
+
+// Set when the terminal is resized (or Ctrl+L) so the typing view is redrawn
+volatile sig_atomic_t resizePending = 0;
+
+#ifndef _WIN32
+// Blocks until stdin, a signal or the timer needs attention, so an idle
+// session costs no CPU at all
+struct EventLoop {
+    int signalFd = -1;
+    int timerFd = -1;
+    int paceFd = -1;                   // Second timer, pacing --autotype
+
+    // Poll stdin for keys; off while keys come from a replay
+    bool watchInput = true;
+
+    // What the last waitForEvents() woke up for
+    bool inputReady = false;
+    bool timerFired = false;
+    bool paceFired = false;
+    bool quitRequested = false;
+
+    // For --wakeups
+    unsigned long wakeups = 0;
+    unsigned long timerWakeups = 0;
+    std::chrono::steady_clock::time_point started;
+};
+
+// Function to route signals and the timer into file descriptors we can poll
+void openEventLoop(EventLoop& loop) {
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGWINCH);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    sigprocmask(SIG_BLOCK, &signals, nullptr);
+
+    loop.signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    loop.timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    loop.paceFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    loop.started = std::chrono::steady_clock::now();
+}
+
+void closeEventLoop(EventLoop& loop) {
+    close(loop.signalFd);
+    close(loop.timerFd);
+    close(loop.paceFd);
+}
+
+// Function to arm the loop timer; interval 0 makes it one-shot, initial 0 disarms it
+void armTimer(EventLoop& loop, long initialMs, long intervalMs) {
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = initialMs / 1000;
+    spec.it_value.tv_nsec = (initialMs % 1000) * 1000000L;
+    spec.it_interval.tv_sec = intervalMs / 1000;
+    spec.it_interval.tv_nsec = (intervalMs % 1000) * 1000000L;
+    timerfd_settime(loop.timerFd, 0, &spec, nullptr);
+}
+
+// Function to sleep until input, a signal, the timer or an optional deadline arrives
+void waitForEvents(EventLoop& loop, const std::chrono::steady_clock::time_point* deadline) {
+    struct pollfd fds[4] = {
+        { loop.watchInput ? STDIN_FILENO : -1, POLLIN, 0 },
+        { loop.signalFd, POLLIN, 0 },
+        { loop.timerFd, POLLIN, 0 },
+        { loop.paceFd, POLLIN, 0 }
+    };
+
+    loop.inputReady = false;
+    loop.timerFired = false;
+    loop.paceFired = false;
+
+    struct timespec timeout = {};
+    if (deadline) {
+        auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(*deadline - std::chrono::steady_clock::now()).count();
+        if (left > 0) {
+            timeout.tv_sec = left / 1000000000LL;
+            timeout.tv_nsec = left % 1000000000LL;
+        }
+    }
+
+    int ready = ppoll(fds, 4, deadline ? &timeout : nullptr, nullptr);
+    loop.wakeups++;
+    if (ready <= 0) return;
+
+    loop.inputReady = fds[0].revents != 0;
+
+    if (fds[1].revents & POLLIN) {
+        struct signalfd_siginfo info;
+        while (read(loop.signalFd, &info, sizeof(info)) == sizeof(info)) {
+            if (info.ssi_signo == SIGWINCH) {
+                resizePending = 1;
+            } else {
+                loop.quitRequested = true;
+            }
+        }
+    }
+
+    if (fds[2].revents & POLLIN) {
+        uint64_t expirations;
+        if (read(loop.timerFd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+            loop.timerFired = true;
+            loop.timerWakeups++;
+        }
+    }
+
+    if (fds[3].revents & POLLIN) {
+        uint64_t expirations;
+        if (read(loop.paceFd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+            loop.paceFired = true;
+        }
+    }
+}
+
+// Function to print how often the loop woke up
+void reportWakeups(const EventLoop& loop) {
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - loop.started).count();
+    unsigned long own = loop.wakeups - loop.timerWakeups;
+    std::cerr << "wakeups: " << own << " in " << seconds << " s ("
+              << own / std::max(seconds, 0.001) << "/s, excluding "
+              << loop.timerWakeups << " report timer ticks)" << std::endl;
+}
+#endif
+
+#ifndef _WIN32
+// Built-in typing for unattended displays (--autotype). Character k is due
+// at start + k / cps on the monotonic clock, so a late wakeup catches up
+// instead of pushing every later character back, and the rate can't drift.
+// The timer ticks once per character at low rates; once characters come
+// faster than frames, it ticks once per frame and everything due since the
+// last tick is revealed in one batch. With jitter, each character's due
+// time moves by a random share of its interval (one-shot timer per
+// character), which looks like a person typing without changing the rate.
+struct AutoType {
+    double cps = 0;
+    double jitter = 0;                           // 0 to 1
+    bool running = false;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::time_point nextDue;   // Jittered mode: the next character
+    std::chrono::nanoseconds tick{0};            // Timer period when not jittering
+    uint64_t due = 0;                            // Characters due so far
+    uint64_t revealed = 0;                       // Characters actually revealed
+    double worstLagMs = 0;                       // Latest a character was revealed
+    std::chrono::steady_clock::time_point last;  // When the last batch went out
+};
+
+// Function to arm a timerfd on the absolute monotonic clock
+void armTimerAt(int fd, std::chrono::steady_clock::time_point first, std::chrono::nanoseconds interval) {
+    auto at = std::chrono::duration_cast<std::chrono::nanoseconds>(first.time_since_epoch()).count();
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = at / 1000000000LL;
+    spec.it_value.tv_nsec = at % 1000000000LL;
+    spec.it_interval.tv_sec = interval.count() / 1000000000LL;
+    spec.it_interval.tv_nsec = interval.count() % 1000000000LL;
+    timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+// Function to find when character k is due
+std::chrono::steady_clock::time_point autoTypeDueTime(const AutoType& at, uint64_t k) {
+    double seconds = k / at.cps;
+    if (at.jitter > 0) {
+        std::uniform_real_distribution<double> shift(-at.jitter / 2, at.jitter / 2);
+        seconds += shift(rng) / at.cps;
+    }
+    return at.start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(std::max(seconds, 0.0)));
+}
+
+// Function to start typing now; frames come at most every frameInterval
+void startAutoType(EventLoop& loop, AutoType& at, std::chrono::steady_clock::duration frameInterval) {
+    at.start = std::chrono::steady_clock::now();
+    at.last = at.start;
+    at.running = true;
+    auto perChar = std::chrono::nanoseconds((long long)(1e9 / at.cps));
+    auto perFrame = std::max(std::chrono::duration_cast<std::chrono::nanoseconds>(frameInterval),
+                             std::chrono::nanoseconds(1000000));
+    if (at.jitter > 0 && perChar >= perFrame) {
+        at.nextDue = autoTypeDueTime(at, 1);
+        armTimerAt(loop.paceFd, at.nextDue, std::chrono::nanoseconds(0));
+    } else {
+        at.jitter = 0;
+        at.tick = std::max(perChar, perFrame);
+        armTimerAt(loop.paceFd, at.start + at.tick, at.tick);
+    }
+}
+
+// Function to count the characters due since the last call and re-arm a
+// jittered timer; called when the pace timer fires
+uint64_t autoTypeDue(EventLoop& loop, AutoType& at) {
+    auto now = std::chrono::steady_clock::now();
+    uint64_t due = at.due;
+    std::chrono::steady_clock::time_point lastDue;
+    if (at.jitter > 0) {
+        while (at.nextDue <= now) {
+            due++;
+            lastDue = at.nextDue;
+            at.nextDue = std::max(at.nextDue, autoTypeDueTime(at, due + 1));
+        }
+        armTimerAt(loop.paceFd, at.nextDue, std::chrono::nanoseconds(0));
+    } else {
+        due = (uint64_t)(std::chrono::duration<double>(now - at.start).count() * at.cps);
+        lastDue = at.start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double>(due / at.cps));
+    }
+    if (due == at.due) return 0;
+
+    // How long after the newest character fell due it went out: wakeup
+    // latency, not the batching, which is by design
+    at.worstLagMs = std::max(at.worstLagMs, std::chrono::duration<double, std::milli>(now - lastDue).count());
+    uint64_t batch = due - at.due;
+    at.due = due;
+    at.last = now;
+    return batch;
+}
+
+// Function to print the rate --autotype asked for and the one it reached
+void reportAutoType(const AutoType& at) {
+    if (!at.running) return;
+    double seconds = std::chrono::duration<double>(at.last - at.start).count();
+    std::cerr << "autotype: target " << at.cps << " cps"
+              << (at.jitter > 0 ? ", jittered" : "")
+              << ", achieved " << (seconds > 0 ? at.revealed / seconds : 0) << " cps"
+              << " (" << at.revealed << " characters in " << seconds << " s)"
+              << ", worst lag " << at.worstLagMs << " ms" << std::endl;
+}
+
+// Function to draw a status string in the top-right corner without moving the write position
+void showStatus(const std::string& status) {
+    int row = screen.cursorRow, col = screen.cursorCol;
+    uint8_t attr = screen.attr;
+
+    screen.attr = ATTR_GRAY;
+    screenMove(screen, 0, std::max(0, screen.cols - (int)status.size()));
+    screenWrite(screen, status.data(), status.size());
+
+    screen.cursorRow = row;
+    screen.cursorCol = col;
+    screen.attr = attr;
+    screen.lastCell = nullptr;
+}
+#endif
+
+// Clock of the main loop and the effects. A fast replay turns it into a
+// virtual clock that jumps straight to the next event instead of waiting.
+struct LoopClock {
+    bool simulated = false;
+    std::chrono::steady_clock::time_point now;
+};
+
+LoopClock loopClock;
+
+std::chrono::steady_clock::time_point loopNow() {
+    return loopClock.simulated ? loopClock.now : std::chrono::steady_clock::now();
+}
+
+// An effect advanced by the scheduler: step() draws the next piece and
+// returns the milliseconds to wait before the following one, or -1 once done
+struct Effect {
+    virtual ~Effect() {}
+    virtual int step() = 0;
+
+    // True for effects that never finish, which a replay does not wait for
+    virtual bool endless() const { return false; }
+};
+
+// One piece of a scripted effect
+struct EffectStep {
+    void (*action)();  // Run before writing, e.g. a colour change; may be null
+    std::string text;
+    int delayMs;       // Pause after this piece
+};
+
+// Effect that plays a fixed list of steps, into a pane if one is set
+struct ScriptEffect : Effect {
+    std::vector<EffectStep> steps;
+    size_t next = 0;
+    Pane* pane = nullptr;
+
+    void add(void (*action)(), const std::string& text, int delayMs) {
+        steps.push_back({ action, text, delayMs });
+    }
+
+    int step() override {
+        if (next >= steps.size()) return -1;
+        const EffectStep& current = steps[next++];
+        Pane* previous = activePane;
+        if (pane) selectPane(pane);
+        if (current.action) current.action();
+        term << current.text;
+        if (pane) selectPane(previous);
+        return current.delayMs;
+    }
+};
+
+// Effect that plays other effects one after another
+struct SequenceEffect : Effect {
+    std::deque<std::unique_ptr<Effect>> effects;
+
+    void add(Effect* effect) {
+        effects.emplace_back(effect);
+    }
+
+    int step() override {
+        while (!effects.empty()) {
+            int delay = effects.front()->step();
+            if (delay >= 0) return delay;
+            effects.pop_front();
+        }
+        return -1;
+    }
+};
+
+// Effect that plays a freshly made effect over and over, pausing in between
+struct RepeatEffect : Effect {
+    std::function<Effect*()> make;
+    int minPauseMs;
+    int maxPauseMs;
+    std::unique_ptr<Effect> current;
+
+    RepeatEffect(std::function<Effect*()> make, int minPauseMs, int maxPauseMs)
+        : make(std::move(make)), minPauseMs(minPauseMs), maxPauseMs(maxPauseMs) {}
+
+    int step() override {
+        if (!current) current.reset(make());
+        int delay = current->step();
+        if (delay >= 0) return delay;
+        current.reset();
+        return std::uniform_int_distribution<>(minPauseMs, maxPauseMs)(rng);
+    }
+
+    bool endless() const override { return true; }
+};
+
+// Effect that runs a function once, e.g. to hand over when a sequence ends
+struct CallbackEffect : Effect {
+    std::function<void()> callback;
+
+    explicit CallbackEffect(std::function<void()> callback) : callback(std::move(callback)) {}
+
+    int step() override {
+        callback();
+        return -1;
+    }
+};
+
+// Timer wheel running effects as concurrent tasks. Tasks hash into a slot by
+// the tick they are due in, so scheduling one and collecting the expired ones
+// does not depend on how many are queued. Deadlines are absolute: each step's
+// delay is added to the previous deadline rather than to the time the step
+// actually ran, so effects keep their pace however late a frame is.
+struct EffectScheduler {
+    static const int kSlots = 256;
+    static const int kTickMs = 10;
+
+    struct Task {
+        std::unique_ptr<Effect> effect;
+        std::chrono::steady_clock::time_point due;
+    };
+
+    std::vector<Task> slots[kSlots];
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+    long long currentTick = 0;  // Slots before this one have been emptied
+    size_t active = 0;
+    size_t endless = 0;         // Of those, effects that never finish
+
+    long long tickOf(std::chrono::steady_clock::time_point t) const {
+        long long ms = std::chrono::duration_cast<std::chrono::milliseconds>(t - origin).count();
+        return std::max(ms / kTickMs, currentTick);
+    }
+};
+
+EffectScheduler effects;
+
+void insertTask(EffectScheduler& s, EffectScheduler::Task task) {
+    s.slots[s.tickOf(task.due) % EffectScheduler::kSlots].push_back(std::move(task));
+}
+
+// Function to start an effect; its first step runs after delayMs
+void scheduleEffect(EffectScheduler& s, Effect* effect, int delayMs = 0) {
+    EffectScheduler::Task task;
+    task.effect.reset(effect);
+    task.due = loopNow() + std::chrono::milliseconds(delayMs);
+    insertTask(s, std::move(task));
+    s.active++;
+    if (effect->endless()) s.endless++;
+}
+
+// Function to run every step that is due; returns how many ran
+int runEffects(EffectScheduler& s, std::chrono::steady_clock::time_point now) {
+    if (s.active == 0) return 0;
+
+    // Collect expired tasks; one lap of the wheel covers any gap
+    std::vector<EffectScheduler::Task> ready;
+    long long nowTick = s.tickOf(now);
+    long long last = std::min(nowTick, s.currentTick + EffectScheduler::kSlots - 1);
+    for (long long tick = s.currentTick; tick <= last; tick++) {
+        std::vector<EffectScheduler::Task>& slot = s.slots[tick % EffectScheduler::kSlots];
+        for (size_t k = 0; k < slot.size(); ) {
+            if (slot[k].due <= now) {
+                ready.push_back(std::move(slot[k]));
+                slot[k] = std::move(slot.back());
+                slot.pop_back();
+            } else {
+                k++;
+            }
+        }
+    }
+    s.currentTick = nowTick;
+
+    // A task that fell behind runs as many steps as it owes
+    int steps = 0;
+    while (!ready.empty()) {
+        EffectScheduler::Task task = std::move(ready.back());
+        ready.pop_back();
+
+        int delay = task.effect->step();
+        steps++;
+        if (delay < 0) {
+            s.active--;
+            continue;
+        }
+        task.due += std::chrono::milliseconds(delay);
+        if (task.due <= now) {
+            ready.push_back(std::move(task));
+        } else {
+            insertTask(s, std::move(task));
+        }
+    }
+    return steps;
+}
+
+// Function to find when the next step is due; false if nothing is scheduled
+bool nextEffectDue(const EffectScheduler& s, std::chrono::steady_clock::time_point& due) {
+    bool found = false;
+    for (int k = 0; k < EffectScheduler::kSlots && s.active > 0; k++) {
+        for (const EffectScheduler::Task& task : s.slots[(s.currentTick + k) % EffectScheduler::kSlots]) {
+            if (!found || task.due < due) {
+                due = task.due;
+                found = true;
+            }
+        }
+        // Later slots only hold later ticks
+        if (found && s.tickOf(due) <= s.currentTick + k) break;
+    }
+    return found;
+}
+
+// Function to add a progress bar to a script
+void showProgressBar(ScriptEffect& script, const std::string& label, int duration_ms) {
+    script.add(nullptr, label, 0);
+    const int width = 30;
+    for (int i = 0; i < width; i++) {
+        // Spread the remainder so the whole bar takes exactly duration_ms
+        script.add(nullptr, "█", (i + 1) * duration_ms / width - i * duration_ms / width);
+    }
+    script.add(nullptr, " [COMPLETE]\n", 0);
+}
+
+// Function to add simulated typing to a script
+void typeText(ScriptEffect& script, const std::string& text, int delay_ms) {
+    for (char c : text) {
+        script.add(nullptr, std::string(1, c), delay_ms);
+    }
+    script.add(nullptr, "\n", 0);
+}
+
+// Function to add a fake error to a script
+void showFakeError(ScriptEffect& script) {
+    char code[8];
+    snprintf(code, sizeof(code), "%x", (unsigned)(rng() % 0xFFFF));
+    script.add(setRedText, std::string("\n*** ERROR 0x") + code + ": Connection terminated\n", 0);
+    script.add(setRedText, "*** Recalibrating network parameters...\n", 1000);
+    script.add(setRedText, "*** Attempting bypass sequence...\n", 800);
+    script.add(setRedText, "*** Rerouting through secondary node...\n", 1200);
+    script.add(setRedText, "*** Connection reestablished\n\n", 0);
+    script.add(resetTextColor, "", 0);
+}
+
+// What the last matrix rain achieved, for --io-stats
+struct RainStats {
+    unsigned long frames = 0;
+    unsigned long dropped = 0;     // Frames skipped because we fell behind
+    unsigned long overBudget = 0;  // Frames cut short by the time budget
+    double seconds = 0;
+    double worstFrameMs = 0;
+};
+
+RainStats rainStats;
+
+// Matrix rain engine sized to the terminal. Drop state is kept per column in
+// one array per field, so a frame is a linear pass over small arrays however
+// wide the screen is. Only the cells a drop touches are written: its new
+// head, the cell behind it that turns green and the tail cell it erases.
+struct MatrixRain : Effect {
+    static const int kFps = 30;
+    static const int kFrameMs = 1000 / kFps;
+
+    int rows = 0, cols = 0;
+    std::vector<int> head;          // Row of each column's drop head; negative while waiting to fall
+    std::vector<uint8_t> length;    // Trail length
+    std::vector<uint8_t> period;    // Frames per row; 1 is the fastest
+    std::vector<uint8_t> countdown; // Frames until the next row
+
+    int duration_ms;
+    int elapsed_ms = 0;
+    int firstColumn = 0;            // Where the next frame starts when the last one ran out of budget
+    double budgetMs = kFrameMs / 2.0;
+    uint64_t state;
+    std::chrono::steady_clock::time_point started, due;
+
+    explicit MatrixRain(int duration_ms) : duration_ms(duration_ms), state(((uint64_t)rng() << 32 | rng()) | 1) {}
+
+    // xorshift64*, as in GeneratorSource
+    uint32_t random() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return (state * 0x2545F4914F6CDD1DULL) >> 32;
+    }
+
+    void spawn(int col, bool anywhere) {
+        // Trails fit the uint8_t however tall the screen is
+        length[col] = std::min<uint32_t>(4 + random() % std::max(4, rows / 2), 255);
+        period[col] = 1 + random() % 3;
+        countdown[col] = period[col];
+        // Start above the screen so columns fall in at different times
+        int span = std::max(rows, 1);
+        head[col] = anywhere ? (int)(random() % span) : -(int)(random() % span);
+    }
+
+    void resize(int newRows, int newCols) {
+        rows = newRows;
+        cols = newCols;
+        head.assign(cols, 0);
+        length.assign(cols, 0);
+        period.assign(cols, 0);
+        countdown.assign(cols, 0);
+        for (int col = 0; col < cols; col++) {
+            spawn(col, false);
+        }
+        firstColumn = 0;
+        clearScreen();
+    }
+
+    void put(int row, int col, char c) {
+        if (row < 0 || row >= rows) return;
+        moveCursor(row + 1, col + 1);
+        term << c;
+    }
+
+    int step() override {
+        auto frameStart = std::chrono::steady_clock::now();
+        auto now = loopNow();
+        if (elapsed_ms == 0 && rows == 0) {
+            started = due = now;
+        }
+        if (elapsed_ms >= duration_ms) {
+            rainStats.seconds = std::chrono::duration<double>(now - started).count();
+            clearScreen();
+            resetTextColor();
+            return -1;
+        }
+
+        // Follow the terminal size; on Linux the screen grid already tracks it
+        int termRows, termCols;
+        #ifdef _WIN32
+        getTerminalSize(termRows, termCols);
+        #else
+        termRows = screen.rows;
+        termCols = screen.cols;
+        #endif
+        if (termRows != rows || termCols != cols) {
+            resize(termRows, termCols);
+        }
+
+        // Advance the columns, stopping early once the frame budget is spent.
+        // The budget runs on the loop clock, so a fast replay (whose clock
+        // stands still within a step) draws the same frames on any machine.
+        int col = firstColumn;
+        for (int done = 0; done < cols; done++, col = col + 1 == cols ? 0 : col + 1) {
+            if ((done & 63) == 63 &&
+                std::chrono::duration<double, std::milli>(loopNow() - now).count() > budgetMs) {
+                rainStats.overBudget++;
+                break;
+            }
+            if (--countdown[col] > 0) continue;
+            countdown[col] = period[col];
+
+            int row = head[col];
+            setGreenText();
+            put(row, col, 33 + random() % 94);
+            put(row - length[col], col, ' ');
+            setGrayText();
+            put(row + 1, col, 33 + random() % 94);
+
+            head[col] = row + 1;
+            if (head[col] - length[col] >= rows) {
+                spawn(col, false);
+            }
+        }
+        firstColumn = col;
+
+        double frameMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+        rainStats.worstFrameMs = std::max(rainStats.worstFrameMs, frameMs);
+        rainStats.frames++;
+
+        // Keep the fixed rate: when we fell behind, skip the frames we missed
+        // instead of drawing them all at once
+        int delay = kFrameMs;
+        auto lag = std::chrono::duration_cast<std::chrono::milliseconds>(now - due).count();
+        if (lag >= kFrameMs) {
+            int missed = lag / kFrameMs;
+            rainStats.dropped += missed;
+            delay += missed * kFrameMs;
+        }
+        due += std::chrono::milliseconds(delay);
+        elapsed_ms += delay;
+
+        // Up to the end of this frame's slot, so a rain cut short still reports its rate
+        rainStats.seconds = std::chrono::duration<double>(due - started).count();
+        return delay;
+    }
+};
+
+// Function to print what the matrix rain achieved
+void reportRainStats() {
+    if (rainStats.frames == 0 || rainStats.seconds <= 0) return;
+    std::cerr << "rain: " << rainStats.frames << " frames in " << rainStats.seconds << " s ("
+              << rainStats.frames / rainStats.seconds << " fps, target " << MatrixRain::kFps
+              << ", " << rainStats.dropped << " dropped, " << rainStats.overBudget << " over budget"
+              << ", worst frame " << rainStats.worstFrameMs << " ms)" << std::endl;
+}
+
+// Function to add IP scanning to a script
+void simulateIPScan(ScriptEffect& script) {
+    script.add(setGreenText, "\nINITIATING NETWORK SCAN...\n\n", 0);
+    
+    std::uniform_int_distribution<> ipDist(1, 255);
+    
+    for (int i = 0; i < 8; i++) {
+        // One draw per statement: operands of + have no defined order
+        std::string ip = std::to_string(ipDist(rng));
+        for (int octet = 1; octet < 4; octet++) {
+            ip += "." + std::to_string(ipDist(rng));
+        }
+        script.add(nullptr, "Probing " + ip + "... ", 200);
+        
+        if (i == 5 || i == 7) { // Make a couple of IPs "vulnerable"
+            script.add(nullptr, "VULNERABLE\n", 300);
+            script.add(nullptr, "  └─ Port 22: OPEN (SSH)\n", 100);
+            script.add(nullptr, "  └─ Port 80: OPEN (HTTP)\n", i == 7 ? 100 : 0);
+            if (i == 7) {
+                script.add(nullptr, "  └─ Port 3306: OPEN (MySQL)\n", 300);
+                script.add(nullptr, "\nTARGET SELECTED: " + ip + "\n", 0);
+            }
+        } else {
+            script.add(nullptr, "SECURE\n", 0);
+        }
+    }
+    
+    script.add(resetTextColor, "", 0);
+}
+
+// Function to build the MS-DOS retro style intro
+SequenceEffect* setupMSDOSStyle() {
+    SequenceEffect* intro = new SequenceEffect();
+
+    // Set light gray text (DOS-like colors) and print DOS-like header
+    ScriptEffect* header = new ScriptEffect();
+    header->add(clearScreen, "", 0);
+    header->add(setGrayText, "\n", 0);
+    header->add(nullptr, "C:\\>HACK.EXE\n", 0);
+    header->add(nullptr, "Microsoft(R) MS-DOS(R) Version 6.22\n", 0);
+    header->add(nullptr, "(C)Copyright Microsoft Corp 1981-1994.\n\n", 0);
     
     // Show progress indicators
-    typeText("Initializing system breach protocol...", 30);
-    showProgressBar("Loading encryption modules: ", 1200);
-    showProgressBar("Establishing secure connection: ", 800);
+    typeText(*header, "Initializing system breach protocol...", 30);
+    showProgressBar(*header, "Loading encryption modules: ", 1200);
+    showProgressBar(*header, "Establishing secure connection: ", 800);
     
     // Add IP scanning for immersion
-    simulateIPScan();
+    simulateIPScan(*header);
+    intro->add(header);
     
     // Matrix effect transition
-    showMatrixRain(2000);
+    intro->add(new MatrixRain(2000));
     
     // Show final screen
+    ScriptEffect* finale = new ScriptEffect();
+    finale->add(clearScreen, "", 0);
+    finale->add(setGrayText, "C:\\>HACK.EXE\n", 0);
+    finale->add(nullptr, "BREACH PROTOCOL INITIALIZED\n", 0);
+    finale->add(nullptr, "SYSTEM ACCESS: GRANTED\n\n", 0);
+    intro->add(finale);
+    return intro;
+}
+
+#ifndef _WIN32
+// Split-screen layout for --panes: typing on the left, a live network scan
+// top right and a log of fake errors below it, each scrolling on its own
+struct PaneLayout {
+    Pane typing;
+    Pane scan;
+    Pane errors;
+    int split = 0;       // Column of the vertical border
+    int logTitle = 0;    // Row of the title above the error log
+};
+
+void placePane(Pane& pane, int top, int left, int rows, int cols) {
+    pane.top = top;
+    pane.left = left;
+    pane.rows = std::max(rows, 0);
+    pane.cols = std::max(cols, 0);
+    pane.cursorRow = 0;
+    pane.cursorCol = 0;
+}
+
+// Function to fit the panes to the screen and draw the borders between them.
+// Everything stays inside the grid: on a very small screen the typing pane
+// keeps at least one cell and the feeds on the right may get none.
+void layoutPanes(PaneLayout& layout, int rows, int cols) {
+    rows = std::max(rows, 1);
+    cols = std::max(cols, 1);
+    layout.split = std::max(cols * 3 / 5, 1);
+    layout.logTitle = rows / 2;
+    int right = layout.split + 1, rightCols = std::max(cols - right, 0);
+    placePane(layout.typing, 0, 0, rows, layout.split);
+    placePane(layout.scan, 1, right, layout.logTitle - 1, rightCols);
+    placePane(layout.errors, layout.logTitle + 1, right, rows - layout.logTitle - 1, rightCols);
+
+    selectPane(nullptr);
+    clearScreen();
+    setGrayText();
+    if (rightCols == 0) return;
+    for (int row = 0; row < rows; row++) {
+        screenMove(screen, row, layout.split);
+        term << "│";
+    }
+    for (int row : { 0, layout.logTitle }) {
+        // The title's "─" is three bytes wide on one column
+        std::string title = row == 0 ? "─ NETWORK SCAN " : "─ SYSTEM LOG ";
+        int written = 0;
+        screenMove(screen, row, right);
+        if ((int)title.size() - 2 < rightCols) {
+            term << title;
+            written = title.size() - 2;
+        }
+        for (int col = written; col < rightCols; col++) term << "─";
+    }
+}
+#endif
+
+// Fixed-capacity ring of text lines. Once full, the oldest line's storage is
+// reused for the newest one, so memory stays flat however long we run.
+struct ScrollbackRing {
+    // Lines longer than this are hard-broken so no single line grows forever
+    static const size_t kMaxLineLength = 1024;
+
+    std::vector<std::string> lines;
+    std::vector<std::string> classes;  // TokenClass per byte when highlighting, else empty
+    size_t head = 0;   // Slot of the oldest line
+    size_t count = 0;  // Lines in use; the last one is still being typed
+
+    // Soft-wrap index: the byte offset each visual row of a line starts at
+    // for a given width. Built lazily for the lines a redraw shows, so a
+    // resize never re-scans the whole history.
+    struct LineWraps {
+        int cols = 0;       // Width the index was built for; 0 when stale
+        bool full = false;  // The last visual row is filled to the edge
+        std::vector<uint32_t> starts;
+    };
+    std::vector<LineWraps> wraps;
+
+    void resize(size_t capacity) {
+        if (capacity < 1) capacity = 1;
+        if (capacity == lines.size()) return;
+
+        // Keep the most recent lines, oldest first
+        std::vector<std::string> kept, keptClasses;
+        size_t keep = std::min(count, capacity);
+        for (size_t k = count - keep; k < count; k++) {
+            kept.push_back(std::move(line(k)));
+            keptClasses.push_back(std::move(lineClasses(k)));
+        }
+        kept.resize(capacity);
+        keptClasses.resize(capacity);
+        lines.swap(kept);
+        classes.swap(keptClasses);
+        wraps.assign(capacity, LineWraps());
+        head = 0;
+        count = keep;
+    }
+
+    // k-th line counting from the oldest one still held
+    std::string& line(size_t k) {
+        return lines[(head + k) % lines.size()];
+    }
+
+    const std::string& line(size_t k) const {
+        return lines[(head + k) % lines.size()];
+    }
+
+    std::string& lineClasses(size_t k) {
+        return classes[(head + k) % classes.size()];
+    }
+
+    const std::string& lineClasses(size_t k) const {
+        return classes[(head + k) % classes.size()];
+    }
+
+    void newLine() {
+        if (count < lines.size()) {
+            count++;
+        } else {
+            head = (head + 1) % lines.size();
+        }
+        line(count - 1).clear();
+        lineClasses(count - 1).clear();
+        wraps[(head + count - 1) % wraps.size()].cols = 0;
+    }
+
+    // Function to get the visual row starts of the k-th line at a width
+    const LineWraps& lineWraps(size_t k, int width) {
+        LineWraps& wrap = wraps[(head + k) % wraps.size()];
+        if (wrap.cols != width) {
+            wrap.cols = width;
+            wrap.starts.assign(1, 0);
+            const std::string& text = line(k);
+            int col = 0;
+            for (size_t b = 0; b < text.size(); b++) {
+                unsigned char c = text[b];
+                // Tabs move to the next stop without wrapping, as the
+                // screen writers place them
+                if (c == '\t') {
+                    col = tabStop(col, width);
+                    continue;
+                }
+                // Continuation bytes and other control characters take no column
+                if ((c & 0xC0) == 0x80 || c < 32) continue;
+                size_t length;
+                int glyphWidth = measureGlyph(text.data(), text.size(), b, length);
+                if (glyphWidth == 0) continue;
+                if (col > 0 && col + glyphWidth > width) {
+                    wrap.starts.push_back(b);
+                    col = 0;
+                }
+                col += glyphWidth;
+            }
+            wrap.full = col == width;
+        }
+        return wrap;
+    }
+
+    // Function to add text; tokens holds a TokenClass per byte, or is null when not highlighting
+    void append(const char* chars, const char* tokens, size_t n) {
+        if (count == 0) newLine();
+        wraps[(head + count - 1) % wraps.size()].cols = 0;
+        for (size_t k = 0; k < n; k++) {
+            if (chars[k] == '\n') {
+                newLine();
+                continue;
+            }
+            // Long lines are split, but never inside a UTF-8 sequence
+            if (line(count - 1).size() >= kMaxLineLength && (chars[k] & 0xC0) != 0x80) newLine();
+            line(count - 1) += chars[k];
+            if (tokens) lineClasses(count - 1) += tokens[k];
+        }
+    }
+
+    // Function to change the class of the last n bytes of the current line
+    void recolorTail(size_t n, uint8_t token) {
+        if (count == 0) return;
+        std::string& tail = lineClasses(count - 1);
+        for (size_t k = tail.size() - std::min(n, tail.size()); k < tail.size(); k++) {
+            tail[k] = token;
+        }
+    }
+};
+
+// Function to write text in its token colours; tokens may be null (all plain text)
+void writeClassified(const char* chars, const char* tokens, size_t n) {
+    if (!tokens) {
+        setTokenColor(TOKEN_TEXT);
+        consoleWrite(chars, n);
+        return;
+    }
+    for (size_t start = 0; start < n; ) {
+        // One colour change per run of equal classes
+        size_t end = start + 1;
+        while (end < n && tokens[end] == tokens[start]) end++;
+        setTokenColor(tokens[start]);
+        consoleWrite(chars + start, end - start);
+        start = end;
+    }
+}
+
+// Function to write a line held in the ring, from a byte offset on
+void writeRingLine(const ScrollbackRing& ring, size_t k, size_t from = 0) {
+    const std::string& chars = ring.line(k);
+    const std::string& tokens = ring.lineClasses(k);
+    writeClassified(chars.data() + from, tokens.size() == chars.size() ? tokens.data() + from : nullptr,
+                    chars.size() - from);
+}
+
+// Function to find which lines fill the last `avail` rows at a width: the
+// first visible line and the byte offset of its first visible row. Only the
+// lines walked here get their wrap index (re)built.
+void findVisibleLines(ScrollbackRing& ring, int avail, int cols, bool cursorAfterLast,
+                      size_t& first, size_t& from) {
+    first = ring.count;
+    from = 0;
+    int used = 0;
+    while (first > 0 && used < avail) {
+        const ScrollbackRing::LineWraps& wrap = ring.lineWraps(first - 1, cols);
+        int lineRows = wrap.starts.size();
+        if (cursorAfterLast && first == ring.count && wrap.full) lineRows++;  // The cursor wraps to a new row
+        first--;
+        if (used + lineRows > avail) {
+            // Only the bottom rows of this line fit
+            size_t skip = used + lineRows - avail;
+            from = skip < wrap.starts.size() ? wrap.starts[skip] : ring.line(first).size();
+        }
+        used += lineRows;
+    }
+}
+
+// Function to display text with proper formatting; rows excludes the header
+void displayText(ScrollbackRing& ring, int rows, int cols) {
+    setGreenText();
+
+    // Leave room for the cursor line below the text
+    size_t first, from;
+    findVisibleLines(ring, std::max(1, rows - 2), cols, false, first, from);
+    for (size_t k = first; k < ring.count; k++) {
+        writeRingLine(ring, k, k == first ? from : 0);
+        term << "\n";
+    }
+    
+    resetTextColor();
+}
+
+// Header rows above the typed text
+const int kTypingHeaderRows = 3;
+
+// Function to draw the header of the typing view
+void showTypingHeader() {
+    setGrayText();
+    term << "C:\\HACK>DECRYPT.EXE" << "\n";
+    term << "SCANNING NETWORK..." << "\n\n";
+}
+
+// Function to redraw the whole typing view (start, resize and Ctrl+L only).
+// Only the lines that fit on screen are laid out and written.
+void redrawTypingView(ScrollbackRing& ring, int rows, int cols) {
     clearScreen();
+    showTypingHeader();
+
+    size_t first, from;
+    findVisibleLines(ring, std::max(1, rows - kTypingHeaderRows), cols, true, first, from);
+    for (size_t k = first; k < ring.count; k++) {
+        if (k > first) term << "\n";
+        writeRingLine(ring, k, k == first ? from : 0);
+    }
+
+    // Blinking cursor; "\b" parks the terminal cursor on it so the next
+    // append overwrites it in place
+    setGrayText();
+    term << "_\b";
+}
+
+// Functions around appending newly revealed text without touching the rest
+// of the screen: erase the cursor, write only the new characters, put it back
+void beginAppend() {
+    term << " \b";
+}
+
+void endAppend() {
     setGrayText();
-    std::cout << "C:\\>HACK.EXE" << std::endl;
-    std::cout << "BREACH PROTOCOL INITIALIZED" << std::endl;
-    std::cout << "SYSTEM ACCESS: GRANTED" << std::endl << std::endl;
+    term << "_\b";
+}
+
+// Function to reveal text, classifying every byte exactly once as it arrives
+void revealHighlighted(std::string_view chunk, Highlighter& highlighter, ScrollbackRing& ring, bool draw) {
+    for (size_t k = 0; k < chunk.size(); ) {
+        // A multi-byte character takes the class of its first byte and is
+        // written whole, so no colour change lands inside it
+        char tokens[4];
+        size_t length = 0;
+        do {
+            char token = highlighter.classify(chunk[k + length]);
+            if (highlighter.recolorLength) {
+                ring.recolorTail(highlighter.recolorLength, highlighter.recolor);
+                if (draw) recolorLast(highlighter.recolorLength, highlighter.recolor);
+            }
+            tokens[length] = length == 0 ? token : tokens[0];
+            length++;
+        } while (length < sizeof(tokens) && k + length < chunk.size() &&
+                 ((unsigned char)chunk[k + length] & 0xC0) == 0x80);
+        ring.append(chunk.data() + k, tokens, length);
+        if (draw) writeClassified(chunk.data() + k, tokens, length);
+        k += length;
+    }
+}
+
+// Hot path instrumentation for --stats. The main loop only calls into it
+// when enabled, so with it off the cost is a branch per frame.
+struct Stats {
+    bool enabled = false;
+
+    // Power-of-two microsecond buckets: bucket k holds [2^(k-1), 2^k) us
+    static const int kBuckets = 32;
+    unsigned long keyToPaint[kBuckets] = {};
+    unsigned long frameBuild[kBuckets] = {};
+
+    unsigned long keys = 0;
+    unsigned long frames = 0;
+    double buildUsTotal = 0;
+    double worstBuildUs = 0;
+    double worstKeyToPaintUs = 0;
+    unsigned long allocations = 0;
+    unsigned long maxFrameAllocations = 0;
+    size_t peakResident = 0;
+
+    // Keys read but not yet painted, and the time the oldest arrived
+    bool keysPending = false;
+    std::chrono::steady_clock::time_point oldestKey;
+    unsigned long allocationsAtLastFrame = 0;
+
+    // Totals at the last overlay refresh, for per-second figures
+    unsigned long overlayFrames = 0;
+    unsigned long overlaySyscalls = 0;
+    unsigned long long overlayBytes = 0;
+    unsigned long overlayAllocations = 0;
+};
+
+Stats stats;
+
+int statsBucket(double us) {
+    int bucket = 0;
+    while (bucket < Stats::kBuckets - 1 && us >= (double)(1UL << bucket)) bucket++;
+    return bucket;
+}
+
+// Upper bound in microseconds of the bucket holding fraction p of the samples
+unsigned long histogramPercentile(const unsigned long* histogram, double p) {
+    unsigned long total = 0;
+    for (int k = 0; k < Stats::kBuckets; k++) total += histogram[k];
+    unsigned long seen = 0;
+    for (int k = 0; k < Stats::kBuckets; k++) {
+        seen += histogram[k];
+        if (total > 0 && seen >= p * total) return 1UL << k;
+    }
+    return 0;
+}
+
+// Function to get the resident set size in bytes (0 where unsupported)
+size_t residentBytes() {
+    #ifdef _WIN32
+    return 0;
+    #else
+    // Second field of statm: resident pages
+    char buffer[128];
+    int fd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    ssize_t n = read(fd, buffer, sizeof(buffer) - 1);
+    close(fd);
+    if (n <= 0) return 0;
+    buffer[n] = 0;
+    unsigned long size = 0, resident = 0;
+    sscanf(buffer, "%lu %lu", &size, &resident);
+    return resident * sysconf(_SC_PAGESIZE);
+    #endif
+}
+
+void startStats(Stats& st) {
+    st.enabled = true;
+    out.timeWrites = true;
+    countAllocations = true;
+    st.allocationsAtLastFrame = allocationCount.load(std::memory_order_relaxed);
+}
+
+// Function to note that keys were read; the latency runs until they are painted
+void statsKeys(Stats& st, size_t count) {
+    st.keys += count;
+    if (!st.keysPending) {
+        st.keysPending = true;
+        st.oldestKey = std::chrono::steady_clock::now();
+    }
+}
+
+// Function to record a frame; frameStart is when presentFrame() was called
+void statsFrame(Stats& st, std::chrono::steady_clock::time_point frameStart) {
+    auto painted = std::chrono::steady_clock::now();
+    double buildUs = std::chrono::duration<double, std::micro>(painted - frameStart - out.lastWriteTime).count();
+    st.frames++;
+    st.frameBuild[statsBucket(buildUs)]++;
+    st.buildUsTotal += buildUs;
+    st.worstBuildUs = std::max(st.worstBuildUs, buildUs);
+
+    if (st.keysPending) {
+        double latencyUs = std::chrono::duration<double, std::micro>(painted - st.oldestKey).count();
+        st.keyToPaint[statsBucket(latencyUs)]++;
+        st.worstKeyToPaintUs = std::max(st.worstKeyToPaintUs, latencyUs);
+        st.keysPending = false;
+    }
+
+    unsigned long allocations = allocationCount.load(std::memory_order_relaxed);
+    st.maxFrameAllocations = std::max(st.maxFrameAllocations, allocations - st.allocationsAtLastFrame);
+    st.allocations += allocations - st.allocationsAtLastFrame;
+    st.allocationsAtLastFrame = allocations;
+}
+
+// Function to build the one-line overlay from the figures since the last call
+std::string statsOverlay(Stats& st) {
+    size_t resident = residentBytes();
+    st.peakResident = std::max(st.peakResident, resident);
+
+    unsigned long frames = std::max(1UL, out.frames - st.overlayFrames);
+    char line[200];
+    snprintf(line, sizeof(line),
+             "[ key>paint p50<%luus p99<%luus | build %.0fus | %lluB %.1fwr %.1falloc /frame | RSS %.1fM ]",
+             histogramPercentile(st.keyToPaint, 0.5), histogramPercentile(st.keyToPaint, 0.99),
+             st.buildUsTotal / std::max(1UL, st.frames),
+             (out.bytes - st.overlayBytes) / frames,
+             (double)(out.syscalls - st.overlaySyscalls) / frames,
+             (double)(st.allocations - st.overlayAllocations) / frames,
+             resident / (1024.0 * 1024.0));
+    st.overlayFrames = out.frames;
+    st.overlaySyscalls = out.syscalls;
+    st.overlayBytes = out.bytes;
+    st.overlayAllocations = st.allocations;
+    return line;
+}
+
+// Function to print the full summary on exit
+void reportStats(Stats& st) {
+    st.peakResident = std::max(st.peakResident, residentBytes());
+    unsigned long frames = std::max(1UL, st.frames);
+    std::cerr << "stats: " << st.keys << " keys, " << st.frames << " frames" << std::endl;
+    std::cerr << "  key to paint (us, bucket upper bounds): p50 " << histogramPercentile(st.keyToPaint, 0.5)
+              << ", p90 " << histogramPercentile(st.keyToPaint, 0.9)
+              << ", p99 " << histogramPercentile(st.keyToPaint, 0.99)
+              << ", worst " << st.worstKeyToPaintUs << std::endl;
+    std::cerr << "  frame build (us): mean " << st.buildUsTotal / frames
+              << ", p99 " << histogramPercentile(st.frameBuild, 0.99)
+              << ", worst " << st.worstBuildUs << std::endl;
+    std::cerr << "  output: " << out.bytes << " bytes (" << out.bytes / std::max(1UL, out.frames) << "/frame), "
+              << out.syscalls << " write syscalls (" << (double)out.syscalls / std::max(1UL, out.frames) << "/frame)" << std::endl;
+    std::cerr << "  allocations: " << st.allocations << " (" << (double)st.allocations / frames
+              << "/frame, max " << st.maxFrameAllocations << ")" << std::endl;
+    std::cerr << "  resident: " << residentBytes() / 1024 << " KiB (peak " << st.peakResident / 1024 << " KiB)" << std::endl;
+
+    // Histogram rows for anything that wants more than percentiles
+    std::cerr << "  key to paint histogram:";
+    for (int k = 0; k < Stats::kBuckets; k++) {
+        if (st.keyToPaint[k]) std::cerr << " <" << (1UL << k) << "us:" << st.keyToPaint[k];
+    }
+    std::cerr << std::endl;
+}
+
+// Keystroke recordings (--record, --replay): a header with what a replay
+// needs to reproduce the run, then every batch of keys as it was read
+struct RecordingHeader {
+    char magic[4];       // "HTRC"
+    uint32_t version;
+    uint64_t seed;
+    uint16_t rows;
+    uint16_t cols;
+    uint32_t reserved;
+};
+
+struct RecordedKeys {
+    uint64_t micros;     // Since the main loop started
+    uint32_t length;     // Key bytes that follow
+    uint32_t reserved;
+};
+
+struct KeyRecorder {
+    std::ofstream file;
+    std::chrono::steady_clock::time_point start;
+};
+
+bool openRecording(KeyRecorder& recorder, const std::string& path, uint64_t seed, int rows, int cols) {
+    recorder.file.open(path, std::ios::binary | std::ios::trunc);
+    if (!recorder.file) return false;
+    RecordingHeader header = { { 'H', 'T', 'R', 'C' }, 1, seed, (uint16_t)rows, (uint16_t)cols, 0 };
+    recorder.file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    recorder.start = loopNow();
+    return recorder.file.good();
+}
+
+void recordKeys(KeyRecorder& recorder, const char* keys, size_t count) {
+    RecordedKeys batch = {};
+    batch.micros = std::chrono::duration_cast<std::chrono::microseconds>(loopNow() - recorder.start).count();
+    batch.length = count;
+    recorder.file.write(reinterpret_cast<const char*>(&batch), sizeof(batch));
+    recorder.file.write(keys, count);
+}
+
+// A recording being played back; its batches are handed out as they fall due
+struct KeyReplay {
+    Corpus file;
+    RecordingHeader header;
+    size_t pos = sizeof(RecordingHeader);  // Next batch
+    size_t taken = 0;                      // Its bytes already handed out
+    size_t end = 0;                        // Past the last well-formed batch, set by openReplay()
+    bool damaged = false;                  // Batches after end were dropped
+    std::chrono::steady_clock::time_point start;
+
+    bool done() const {
+        return pos >= end;
+    }
+
+    // When the next batch is due
+    std::chrono::steady_clock::time_point nextDue() const {
+        RecordedKeys batch;
+        memcpy(&batch, file.text.data() + pos, sizeof(batch));
+        return start + std::chrono::microseconds(batch.micros);
+    }
+};
+
+// Longest a recording may run; later timestamps can only come from a damaged file
+const uint64_t kMaxRecordingMicros = 24ull * 60 * 60 * 1000 * 1000;
+
+// Function to open a recording. The replay ends before the first batch whose
+// timestamp goes backwards or is out of range, so bad data stops it cleanly
+bool openReplay(KeyReplay& replay, const std::string& path) {
+    if (!replay.file.load(path) || replay.file.text.size() < sizeof(RecordingHeader)) return false;
+    memcpy(&replay.header, replay.file.text.data(), sizeof(RecordingHeader));
+    if (memcmp(replay.header.magic, "HTRC", 4) != 0 || replay.header.version != 1) return false;
+
+    std::string_view text = replay.file.text;
+    uint64_t previous = 0;
+    size_t pos = sizeof(RecordingHeader);
+    while (pos + sizeof(RecordedKeys) <= text.size()) {
+        RecordedKeys batch;
+        memcpy(&batch, text.data() + pos, sizeof(batch));
+        if (batch.micros < previous || batch.micros > kMaxRecordingMicros) {
+            replay.damaged = true;
+            break;
+        }
+        previous = batch.micros;
+        pos += sizeof(batch) + std::min<size_t>(batch.length, text.size() - pos - sizeof(batch));
+    }
+    replay.end = pos;
+    return true;
+}
+
+// Function to take the keys of every batch due by now; returns how many
+size_t replayKeys(KeyReplay& replay, std::chrono::steady_clock::time_point now, char* keys, size_t capacity) {
+    size_t count = 0;
+    while (!replay.done() && replay.nextDue() <= now) {
+        RecordedKeys batch;
+        memcpy(&batch, replay.file.text.data() + replay.pos, sizeof(batch));
+        size_t length = std::min<size_t>(batch.length, replay.file.text.size() - replay.pos - sizeof(batch));
+
+        // A batch bigger than the buffer (only a damaged or foreign file has
+        // one) goes out a buffer at a time rather than stalling the replay
+        size_t rest = length - replay.taken;
+        if (count > 0 && count + rest > capacity) break;
+        size_t take = std::min(rest, capacity);
+        memcpy(keys + count, replay.file.text.data() + replay.pos + sizeof(batch) + replay.taken, take);
+        count += take;
+        replay.taken += take;
+        if (replay.taken < length) break;
+        replay.pos += sizeof(batch) + length;
+        replay.taken = 0;
+    }
+    return count;
+}
+
+// Function to reveal the text for one key press. highlighter is null when
+// not highlighting; draw is false when the screen is rebuilt from the ring.
+// Returns how many characters it revealed (fewer at the end of the text).
+size_t revealForKey(TextSource& source, size_t wanted, ScrollbackRing& ring, Highlighter* highlighter, bool draw) {
+    size_t requested = wanted;
+    if (draw) {
+        beginAppend();
+    }
+    while (wanted > 0) {
+        std::string_view chunk = source.next(wanted);
+        if (chunk.empty()) break;
+        if (highlighter) {
+            revealHighlighted(chunk, *highlighter, ring, draw);
+        } else {
+            ring.append(chunk.data(), nullptr, chunk.size());
+            if (draw) {
+                writeClassified(chunk.data(), nullptr, chunk.size());
+            }
+        }
+    }
+    if (draw) {
+        endAppend();
+    }
+    return requested - wanted;
+}
+
+#ifndef _WIN32
+// Server mode (--serve): many remote terminals typed by one process. Every
+// session reads the same mapped corpus; what a session owns is only its
+// cursor into it, its scrollback and its terminal size. One epoll loop
+// drives all of them, and each batch of keys costs one write to its socket.
+struct Session {
+    int fd = -1;
+    size_t pos = 0;             // Cursor into the shared corpus
+    std::shared_ptr<const CorpusFile> file;  // With --watch: the file typed, pinned while it is
+    uint64_t generation = 0;                 // and the snapshot it came from
+    ScrollbackRing ring;
+    int rows = 24;
+    int cols = 80;
+
+    std::string pending;        // Output the socket has not accepted yet
+    bool waitingToWrite = false;  // EPOLLOUT is armed
+
+    // Telnet option parsing (TCP sessions only)
+    bool telnet = false;
+    uint8_t telnetState = 0;
+    std::string subnegotiation;
+};
+
+struct Server {
+    int listenFd = -1;
+    int epollFd = -1;
+    int signalFd = -1;
+    int reserveFd = -1;         // Given up to shed a connection when descriptors run out
+    bool listenPaused = false;  // Without a reserve, out of epoll until a session closes
+    bool tcp = false;
+    std::string unixPath;
+
+    std::string_view text;      // The shared corpus
+    TextIndex index;            // Its character boundaries, shared too; built by openServer()
+    CorpusWatcher* watcher = nullptr;  // With --watch, sessions type its snapshots instead
+    size_t charsToAdd = 5;
+    int scrollback = 0;
+
+    std::vector<std::unique_ptr<Session>> sessions;  // Indexed by socket
+    size_t sessionCount = 0;
+
+    // Totals for --io-stats
+    unsigned long accepted = 0;
+    unsigned long rejected = 0;
+    unsigned long keys = 0;
+    unsigned long writes = 0;
+    unsigned long long bytes = 0;
+};
+
+enum TelnetState : uint8_t {
+    TELNET_DATA, TELNET_IAC, TELNET_OPTION, TELNET_SB, TELNET_SB_IAC
+};
+
+const unsigned char TELNET_SE = 240, TELNET_SB_CMD = 250, TELNET_WILL = 251, TELNET_DONT = 254,
+                    TELNET_IAC_CMD = 255, TELNET_ECHO = 1, TELNET_SGA = 3, TELNET_NAWS = 31;
+
+// Function to index the corpus and open the listening socket: a path is a
+// Unix socket, [HOST:]PORT is TCP
+bool openServer(Server& server, const std::string& address) {
+    server.index.reset(server.text);
+    if (address.find('/') != std::string::npos) {
+        struct sockaddr_un addr = {};
+        addr.sun_family = AF_UNIX;
+        if (address.size() >= sizeof(addr.sun_path)) return false;
+        memcpy(addr.sun_path, address.c_str(), address.size() + 1);
+        unlink(address.c_str());
+        server.listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (server.listenFd < 0 || bind(server.listenFd, (struct sockaddr*)&addr, sizeof(addr)) != 0) return false;
+        server.unixPath = address;
+    } else {
+        // Local connections only unless a host is given
+        std::string host = "127.0.0.1", port = address;
+        size_t colon = address.rfind(':');
+        if (colon != std::string::npos) {
+            if (colon > 0) host = address.substr(0, colon);
+            port = address.substr(colon + 1);
+        }
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(std::atoi(port.c_str()));
+        if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) return false;
+        server.listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        int on = 1;
+        setsockopt(server.listenFd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+        if (server.listenFd < 0 || bind(server.listenFd, (struct sockaddr*)&addr, sizeof(addr)) != 0) return false;
+        server.tcp = true;
+    }
+    if (listen(server.listenFd, 1024) != 0) return false;
+
+    // Sessions are bounded by descriptors, so take all we are allowed
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    server.reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    sigprocmask(SIG_BLOCK, &signals, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+    server.signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+    server.epollFd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = server.listenFd;
+    epoll_ctl(server.epollFd, EPOLL_CTL_ADD, server.listenFd, &event);
+    event.data.fd = server.signalFd;
+    epoll_ctl(server.epollFd, EPOLL_CTL_ADD, server.signalFd, &event);
+    return true;
+}
+
+// Function to add text for a remote terminal; it has no grid of ours, so newlines become CRLF
+void appendSessionText(std::string& buffer, const char* chars, size_t n) {
+    for (size_t start = 0; start < n; ) {
+        const char* newline = static_cast<const char*>(memchr(chars + start, '\n', n - start));
+        size_t end = newline ? newline - chars : n;
+        buffer.append(chars + start, end - start);
+        if (newline) buffer += "\r\n";
+        start = end + 1;
+    }
+}
+
+// Function to send what the socket will take; false if the session must go
+bool flushSession(Server& server, Session& session) {
+    while (!session.pending.empty()) {
+        ssize_t n = send(session.fd, session.pending.data(), session.pending.size(), MSG_NOSIGNAL);
+        server.writes++;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN) return false;
+            break;
+        }
+        server.bytes += n;
+        session.pending.erase(0, n);
+    }
+
+    // Wait for room only while something is left; a client that stops
+    // reading is dropped. The mask changes only when that flips.
+    bool waiting = !session.pending.empty();
+    if (waiting != session.waitingToWrite) {
+        struct epoll_event event = {};
+        event.events = EPOLLIN | (waiting ? uint32_t(EPOLLOUT) : 0u);
+        event.data.fd = session.fd;
+        epoll_ctl(server.epollFd, EPOLL_CTL_MOD, session.fd, &event);
+        session.waitingToWrite = waiting;
+    }
+    return session.pending.size() < (1 << 20);
+}
+
+// Function to redraw a session's whole view from its scrollback
+void redrawSession(Session& session) {
+    std::string& buffer = session.pending;
+    buffer += attrCodes[ATTR_GRAY];
+    buffer += "\033[H\033[2JC:\\HACK>DECRYPT.EXE\r\nSCANNING NETWORK...\r\n\r\n";
+    buffer += attrTransitions[ATTR_GRAY][ATTR_GREEN];
+
+    size_t first, from;
+    findVisibleLines(session.ring, std::max(1, session.rows - kTypingHeaderRows), session.cols, true, first, from);
+    for (size_t k = first; k < session.ring.count; k++) {
+        if (k > first) buffer += "\r\n";
+        const std::string& line = session.ring.line(k);
+        size_t start = k == first ? from : 0;
+        buffer.append(line, start, line.size() - start);
+    }
+    buffer += attrTransitions[ATTR_GREEN][ATTR_GRAY];
+    buffer += "_\b";
+}
+
+// Largest window a client may claim; its scrollback is sized from the rows
+const int kMaxSessionSize = 1000;
+
+void resizeSession(Server& server, Session& session, int rows, int cols) {
+    session.rows = std::min(std::max(rows, kTypingHeaderRows + 1), kMaxSessionSize);
+    session.cols = std::min(std::max(cols, 1), kMaxSessionSize);
+    session.ring.resize(session.rows + server.scrollback);
 }
 
-// Function to display text with proper formatting
-void displayText(const std::string& text) {
-    setGreenText();
-    
-    std::istringstream stream(text);
-    std::string line;
-    
-    while(std::getline(stream, line)) {
-        std::cout << line << std::endl;
+void closeSession(Server& server, int fd) {
+    epoll_ctl(server.epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    server.sessions[fd].reset();
+    server.sessionCount--;
+
+    if (server.listenPaused) {
+        if (server.reserveFd < 0) server.reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = server.listenFd;
+        epoll_ctl(server.epollFd, EPOLL_CTL_ADD, server.listenFd, &event);
+        server.listenPaused = false;
     }
-    
-    resetTextColor();
 }
 
+void acceptSessions(Server& server) {
+    while (true) {
+        int fd = accept4(server.listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            if ((errno == EMFILE || errno == ENFILE) && server.reserveFd >= 0) {
+                // The listener is level-triggered: take the connection off
+                // the queue and drop it, or epoll reports it forever
+                close(server.reserveFd);
+                int shed = accept4(server.listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+                int shedError = errno;
+                if (shed >= 0) close(shed);
+                server.reserveFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                if (shed >= 0) {
+                    server.rejected++;
+                    continue;
+                }
+                if (shedError == EAGAIN || shedError == EWOULDBLOCK) return;
+                errno = shedError;
+            }
+            if (errno == EMFILE || errno == ENFILE) {
+                epoll_ctl(server.epollFd, EPOLL_CTL_DEL, server.listenFd, nullptr);
+                server.listenPaused = true;
+                return;
+            }
+            std::cerr << "serve: accept: " << strerror(errno) << std::endl;
+            return;
+        }
+
+        if ((size_t)fd >= server.sessions.size()) server.sessions.resize(fd + 1);
+        server.sessions[fd].reset(new Session());
+        Session& session = *server.sessions[fd];
+        session.fd = fd;
+        server.sessionCount++;
+        server.accepted++;
+
+        // Every session starts at a random line of the shared corpus
+        if (server.watcher) {
+            const CorpusSnapshot& snapshot = *server.watcher->latest();
+            followSnapshot(snapshot, session.file, session.pos);
+            session.generation = snapshot.generation;
+        } else {
+            size_t start = std::uniform_int_distribution<size_t>(0, server.text.size() - 1)(rng);
+            const char* newline = static_cast<const char*>(memchr(server.text.data() + start, '\n', server.text.size() - start));
+            session.pos = newline ? newline - server.text.data() + 1 : 0;
+            if (session.pos >= server.text.size()) session.pos = 0;
+        }
+        resizeSession(server, session, 24, 80);
+
+        struct epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        epoll_ctl(server.epollFd, EPOLL_CTL_ADD, fd, &event);
+
+        if (server.tcp) {
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+            // Character mode with our echo, and ask for the window size
+            session.telnet = true;
+            const unsigned char negotiate[] = {
+                TELNET_IAC_CMD, TELNET_WILL, TELNET_ECHO,
+                TELNET_IAC_CMD, TELNET_WILL, TELNET_SGA,
+                TELNET_IAC_CMD, 253 /* DO */, TELNET_NAWS
+            };
+            session.pending.append(reinterpret_cast<const char*>(negotiate), sizeof(negotiate));
+        }
+        redrawSession(session);
+        if (!flushSession(server, session)) closeSession(server, fd);
+    }
+}
+
+// Function to handle what a session sent; false if it should be closed
+bool handleSessionInput(Server& server, Session& session, const unsigned char* data, size_t n) {
+    bool cursorHidden = false;
+    bool redraw = false;
+
+    for (size_t k = 0; k < n; k++) {
+        unsigned char c = data[k];
+
+        // Strip telnet commands; only the window size is of interest
+        if (session.telnet) {
+            switch (session.telnetState) {
+            case TELNET_DATA:
+                if (c == TELNET_IAC_CMD) {
+                    session.telnetState = TELNET_IAC;
+                    continue;
+                }
+                break;
+            case TELNET_IAC:
+                if (c == TELNET_IAC_CMD) {
+                    session.telnetState = TELNET_DATA;
+                    break;  // Escaped 255 is data
+                }
+                session.telnetState = c == TELNET_SB_CMD ? TELNET_SB :
+                                      (c >= TELNET_WILL && c <= TELNET_DONT) ? TELNET_OPTION : TELNET_DATA;
+                session.subnegotiation.clear();
+                continue;
+            case TELNET_OPTION:
+                session.telnetState = TELNET_DATA;
+                continue;
+            case TELNET_SB:
+                if (c == TELNET_IAC_CMD) session.telnetState = TELNET_SB_IAC;
+                else if (session.subnegotiation.size() < 16) session.subnegotiation += (char)c;
+                continue;
+            case TELNET_SB_IAC:
+                if (c == TELNET_IAC_CMD) {
+                    session.telnetState = TELNET_SB;
+                    if (session.subnegotiation.size() < 16) session.subnegotiation += (char)c;
+                    continue;
+                }
+                session.telnetState = TELNET_DATA;
+                if (c == TELNET_SE && session.subnegotiation.size() >= 5 &&
+                    (unsigned char)session.subnegotiation[0] == TELNET_NAWS) {
+                    const unsigned char* size = reinterpret_cast<const unsigned char*>(session.subnegotiation.data()) + 1;
+                    int width = size[0] << 8 | size[1], height = size[2] << 8 | size[3];
+                    // 0 means the client does not know; keep what we have
+                    if (width > 0 && height > 0) {
+                        resizeSession(server, session, height, width);
+                        redraw = true;
+                    }
+                }
+                continue;
+            }
+        }
+
+        if (c == 3 || c == 4) return false;  // Ctrl+C, Ctrl+D
+        if (c == 12) {                        // Ctrl+L
+            redraw = true;
+            continue;
+        }
+        if (c == '\0') continue;              // Telnet sends CR NUL for Enter
+
+        // Reveal the next text straight into the output, like the local append mode
+        server.keys++;
+        if (!cursorHidden) {
+            session.pending += " \b";
+            session.pending += attrTransitions[ATTR_GRAY][ATTR_GREEN];
+            cursorHidden = true;
+        }
+        std::string_view text = server.text;
+        TextIndex* index = &server.index;
+        if (server.watcher) {
+            // Move on to a reloaded corpus; the old file goes once no session types it
+            const CorpusSnapshot& snapshot = *server.watcher->latest();
+            if (snapshot.generation != session.generation) {
+                followSnapshot(snapshot, session.file, session.pos);
+                session.generation = snapshot.generation;
+            }
+            text = session.file->text;
+            index = &session.file->index;
+        }
+        for (size_t wanted = server.charsToAdd; wanted > 0; ) {
+            size_t end = index->advance(session.pos, wanted);
+            if (end == session.pos) break;  // Nothing to type
+            const char* chars = text.data() + session.pos;
+            session.ring.append(chars, nullptr, end - session.pos);
+            appendSessionText(session.pending, chars, end - session.pos);
+            session.pos = end;
+            if (session.pos >= text.size()) session.pos = 0;
+        }
+    }
+
+    if (redraw) {
+        redrawSession(session);
+    } else if (cursorHidden) {
+        session.pending += attrTransitions[ATTR_GREEN][ATTR_GRAY];
+        session.pending += "_\b";
+    }
+    return true;
+}
+
+// Function to serve sessions until SIGINT/SIGTERM
+void runServer(Server& server) {
+    struct epoll_event events[256];
+    unsigned char input[4096];
+    bool running = true;
+
+    while (running) {
+        int ready = epoll_wait(server.epollFd, events, 256, -1);
+        for (int e = 0; e < ready; e++) {
+            int fd = events[e].data.fd;
+            if (fd == server.listenFd) {
+                acceptSessions(server);
+                continue;
+            }
+            if (fd == server.signalFd) {
+                running = false;
+                continue;
+            }
+            if ((size_t)fd >= server.sessions.size() || !server.sessions[fd]) continue;
+            Session& session = *server.sessions[fd];
+
+            bool keep = true;
+            if (events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                ssize_t n = read(fd, input, sizeof(input));
+                if (n > 0) {
+                    keep = handleSessionInput(server, session, input, n);
+                } else if (n == 0 || errno != EAGAIN) {
+                    keep = false;
+                }
+            }
+            if (keep) keep = flushSession(server, session);
+            if (!keep) closeSession(server, fd);
+        }
+    }
+
+    for (size_t fd = 0; fd < server.sessions.size(); fd++) {
+        if (server.sessions[fd]) closeSession(server, fd);
+    }
+    close(server.listenFd);
+    close(server.epollFd);
+    close(server.signalFd);
+    if (server.reserveFd >= 0) close(server.reserveFd);
+    if (!server.unixPath.empty()) unlink(server.unixPath.c_str());
+}
+
+// Function to print the server totals
+void reportServerStats(const Server& server) {
+    std::cerr << "serve: " << server.accepted << " sessions, " << server.rejected << " rejected, " << server.keys << " keys, "
+              << server.writes << " write syscalls, " << server.bytes << " bytes" << std::endl;
+}
+#endif
+
+#ifndef HACKERTYPER_NO_MAIN
 int main(int argc, char* argv[]) {
     // Set default characters per keystroke
     int charsToAdd = 5;
+
+    // Redraw the whole screen on every keystroke (the old renderer)
+    bool fullRedraw = false;
+    bool usePanes = false;
+    bool headless = false;
+    std::string themeName;
+
+    // Print write syscall and byte counters on exit
+    bool ioStats = false;
+
+    // Show and print how often the event loop wakes up
+    bool reportLoopWakeups = false;
+    unsigned long lastWakeups = 0;
+
+    // Instrument the main loop (see Stats); off by default
+    bool showStats = false;
+
+    // Lines kept beyond one screenful
+    int scrollback = 1000;
+    bool scrollbackSet = false;
+
+    // Serve remote sessions on a Unix socket path or [HOST:]PORT instead of typing locally
+    std::string serveAddress;
+
+    // Frame rate cap; 0 renders after every read
+    int fps = 60;
+
+    // Type by itself at this many characters per second, with this much jitter (0 to 1)
+    double autotypeCps = 0;
+    double autotypeJitter = 0;
+
+    // Corpus pack to load, or scan the search paths for hackertext files
+    // (always the case in a build without the embedded pack)
+    std::string packFile;
+    #ifndef HACKERTYPER_NO_EMBEDDED_PACK
+    bool scan = false;
+    #endif
+
+    // Colour keywords, literals, comments and preprocessor lines
+    bool highlight = false;
+    Highlighter highlighter;
+
+    // Generate endless text from a Markov model of this order instead of repeating the corpus
+    bool generate = false;
+    int markovOrder = 5;
+
+    // Stream a file, directory tree or stdin ("-") instead of a corpus
+    std::string streamPath;
+    std::vector<GlobPattern> streamGlobs;
+
+    // Reuse the cached corpus list; print what discovery finds
+    bool discoveryCache = true;
+    bool verbose = false;
+
+    // Reload corpus files when they change on disk
+    bool watch = false;
+
+    // Random seed (0 picks one), keystroke recording and replay, output file
+    uint64_t seed = 0;
+    std::string recordPath, replayPath, outputPath;
+    bool replayFast = false;
+
+    // Pack tool modes, used by the build to generate the embedded pack
+    if (argc > 2 && (std::string(argv[1]) == "--build-pack" || std::string(argv[1]) == "--embed-pack")) {
+        std::vector<std::string> files(argv + 3, argv + argc);
+        return writePack(argv[2], files, std::string(argv[1]) == "--embed-pack") ? 0 : 1;
+    }
     
     // Allow command-line override
-    if (argc > 1) {
-        charsToAdd = std::atoi(argv[1]);
-        if (charsToAdd <= 0) charsToAdd = 5;
+    for (int a = 1; a < argc; a++) {
+        std::string arg = argv[a];
+        if (arg == "--redraw") {
+            fullRedraw = true;
+        } else if (arg == "--wakeups") {
+            reportLoopWakeups = true;
+        } else if (arg == "--stats") {
+            showStats = true;
+        } else if (arg == "--io-stats") {
+            ioStats = true;
+        } else if (arg == "--scan") {
+            #ifndef HACKERTYPER_NO_EMBEDDED_PACK
+            scan = true;
+            #endif
+        } else if (arg == "--highlight") {
+            highlight = true;
+        } else if (arg == "--generate") {
+            generate = true;
+        } else if (arg == "--order" && a + 1 < argc) {
+            markovOrder = std::atoi(argv[++a]);
+        } else if (arg == "--stream" && a + 1 < argc) {
+            streamPath = argv[++a];
+        } else if (arg == "--stream-match" && a + 1 < argc) {
+            streamGlobs.push_back(compileGlob(argv[++a]));
+        } else if (arg == "--watch") {
+            watch = true;
+        } else if (arg == "--no-cache") {
+            discoveryCache = false;
+        } else if (arg == "--verbose") {
+            verbose = true;
+        } else if (arg == "--seed" && a + 1 < argc) {
+            seed = std::strtoull(argv[++a], nullptr, 10);
+        } else if (arg == "--record" && a + 1 < argc) {
+            recordPath = argv[++a];
+        } else if (arg == "--replay" && a + 1 < argc) {
+            replayPath = argv[++a];
+        } else if (arg == "--replay-fast") {
+            replayFast = true;
+        } else if (arg == "--output" && a + 1 < argc) {
+            outputPath = argv[++a];
+        } else if (arg == "--headless") {
+            headless = true;
+        } else if (arg == "--pack" && a + 1 < argc) {
+            packFile = argv[++a];
+        } else if (arg == "--fps" && a + 1 < argc) {
+            fps = std::atoi(argv[++a]);
+            if (fps < 0) fps = 0;
+        } else if (arg == "--autotype" && a + 1 < argc) {
+            autotypeCps = std::atof(argv[++a]);
+        } else if (arg == "--jitter" && a + 1 < argc) {
+            autotypeJitter = std::min(std::max(std::atof(argv[++a]), 0.0), 1.0);
+        } else if (arg == "--scrollback" && a + 1 < argc) {
+            scrollback = std::atoi(argv[++a]);
+            if (scrollback < 0) scrollback = 0;
+            scrollbackSet = true;
+        } else if (arg == "--serve" && a + 1 < argc) {
+            serveAddress = argv[++a];
+        } else if (arg == "--theme" && a + 1 < argc) {
+            themeName = argv[++a];
+        } else if (arg == "--panes") {
+            usePanes = true;
+        } else {
+            charsToAdd = std::atoi(argv[a]);
+            if (charsToAdd <= 0) charsToAdd = 5;
+        }
     }
     
-    // Get the executable directory
-    std::string exeDir = getExecutableDir();
-    
-    // Define search paths in order of preference
-    std::vector<std::string> searchPaths = {
-        ".",                          // Current directory
-        exeDir,                       // Executable directory
-        "/usr/local/share/hackertyper", // System-wide data directory
-        "/usr/share/hackertyper"      // Alternative system-wide data directory
-    };
-    
-    std::vector<std::string> hackerTextFiles;
-    
-    // Try each search path until we find files
-    for (const auto& path : searchPaths) {
-        hackerTextFiles = listMatchingFiles(path, "hackertext[0-9]*.txt");
-        if (!hackerTextFiles.empty()) {
-            std::cout << "Found files in: " << path << std::endl;
-            break;
+    // Before any thread starts, so allocations are counted everywhere
+    if (showStats) {
+        startStats(stats);
+    }
+
+    // A replay brings its own seed and terminal size
+    KeyReplay replay;
+    bool replaying = !replayPath.empty();
+    if (replaying) {
+        if (!openReplay(replay, replayPath)) {
+            std::cerr << "Error: " << replayPath << " is not a keystroke recording." << std::endl;
+            return 1;
+        }
+        if (replay.damaged) {
+            std::cerr << "Warning: " << replayPath << " has bad timestamps; replaying up to the first one." << std::endl;
         }
+        seed = replay.header.seed;
     }
-    
-    // If no files found, look for the original file in each path
-    if (hackerTextFiles.empty()) {
-        for (const auto& path : searchPaths) {
-            std::string originalFile = path + "/hackertext.txt";
-            std::ifstream test(originalFile);
-            if (test.good()) {
-                hackerTextFiles.push_back(originalFile);
-                std::cout << "Using default file: " << originalFile << std::endl;
-                break;
-            }
+    replayFast = replaying && replayFast;
+    if (seed == 0) {
+        seed = ((uint64_t)std::random_device()() << 32 | std::random_device()()) | 1;
+    }
+    rng.seed(seed);
+
+    if (usePanes) {
+        #ifdef _WIN32
+        std::cerr << "Error: --panes is not supported on Windows." << std::endl;
+        return 1;
+        #else
+        if (fullRedraw) {
+            std::cerr << "Error: --panes cannot be combined with --redraw." << std::endl;
+            return 1;
         }
+        #endif
     }
-    
-    // If still no files found, give up
-    if (hackerTextFiles.empty()) {
-        std::cerr << "Error: Cannot find any hackertext files." << std::endl;
-        std::cerr << "Please make sure hackertext.txt exists in one of the search paths." << std::endl;
+
+    if (watch) {
+        #ifdef _WIN32
+        std::cerr << "Error: --watch is not supported on Windows." << std::endl;
+        return 1;
+        #else
+        if (!packFile.empty() || generate || !streamPath.empty()) {
+            std::cerr << "Error: --watch types from corpus files, not --pack, --generate or --stream." << std::endl;
+            return 1;
+        }
+        if (replaying) {
+            std::cerr << "Error: --watch cannot be combined with --replay." << std::endl;
+            return 1;
+        }
+        #endif
+    }
+
+    if (autotypeCps != 0) {
+        #ifdef _WIN32
+        std::cerr << "Error: --autotype is not supported on Windows." << std::endl;
         return 1;
+        #else
+        if (autotypeCps < 0.1 || autotypeCps > 1e7) {
+            std::cerr << "Error: --autotype takes 0.1 to 10000000 characters per second." << std::endl;
+            return 1;
+        }
+        if (replaying) {
+            std::cerr << "Error: --autotype cannot be combined with --replay." << std::endl;
+            return 1;
+        }
+        #endif
     }
-    
-    // Randomly select a file
-    std::random_device rd;
-    std::mt19937 gen(rd());
-    std::uniform_int_distribution<> fileDist(0, hackerTextFiles.size() - 1);
-    std::string selectedFile = hackerTextFiles[fileDist(gen)];
-    
-    // Read text from the randomly selected file
-    std::string str = readTextFromFile(selectedFile);
-    if (str.empty()) {
-        std::cerr << "Failed to read text file or file is empty." << std::endl;
+
+    if (!themeName.empty()) {
+        #ifdef _WIN32
+        std::cerr << "Error: --theme is not supported on Windows." << std::endl;
         return 1;
+        #else
+        const Theme* theme = findTheme(themeName);
+        if (!theme) {
+            std::cerr << "Error: unknown theme " << themeName << " (dos, ansi, 256 or truecolor)." << std::endl;
+            return 1;
+        }
+        loadTheme(*theme);
+        #endif
+    }
+
+    FileSink fileSink;
+    VtScreen headlessScreen;
+    if (!outputPath.empty()) {
+        if (!fileSink.open(outputPath)) {
+            std::cerr << "Error: cannot write " << outputPath << std::endl;
+            return 1;
+        }
+        out.sink = &fileSink;
+    }
+    if (headless) {
+        out.sink = &headlessScreen;
+    }
+
+    // Corpus source: the embedded pack unless a pack file or scanning is requested
+    Corpus corpus;
+    CorpusPack pack;
+    uint32_t packEntry = 0;
+    CorpusSource corpusSource;
+    TextSource* source = &corpusSource;
+
+    // Generator mode: a Markov model trained on every corpus available
+    std::vector<std::unique_ptr<Corpus>> trainingFiles;
+    std::vector<std::string_view> training;
+    MarkovModel model;
+    std::unique_ptr<GeneratorSource> generator;
+
+    #ifndef _WIN32
+    std::unique_ptr<StreamSource> stream;
+    std::unique_ptr<CorpusWatcher> watcher;
+    std::unique_ptr<WatchedSource> watched;
+    if (!streamPath.empty()) {
+        int sourceFd = -1;
+        if (streamPath == "-") {
+            // The text arrives on stdin, so keys have to come from the terminal itself
+            sourceFd = dup(STDIN_FILENO);
+            int tty = open("/dev/tty", O_RDWR | O_CLOEXEC);
+            if (tty < 0 || dup2(tty, STDIN_FILENO) < 0) {
+                std::cerr << "Error: streaming from stdin needs a controlling terminal." << std::endl;
+                return 1;
+            }
+            close(tty);
+        } else if (access(streamPath.c_str(), R_OK) != 0) {
+            std::cerr << "Error: cannot read " << streamPath << std::endl;
+            return 1;
+        }
+
+        if (streamGlobs.empty()) {
+            for (const char* glob : { "*.c", "*.h", "*.cc", "*.cpp", "*.hpp", "*.cxx", "*.py", "*.js",
+                                      "*.ts", "*.go", "*.rs", "*.java", "*.sh", "*.S", "Makefile",
+                                      "Kconfig", "hackertext*.txt" }) {
+                streamGlobs.push_back(compileGlob(glob));
+            }
+        }
+        stream.reset(new StreamSource(streamPath, sourceFd, streamGlobs));
+        source = stream.get();
+    } else
+    #endif
+    {
+        if (!packFile.empty()) {
+            if (!corpus.load(packFile) || !openPack(corpus.text, pack)) {
+                std::cerr << "Error: " << packFile << " is not a valid corpus pack." << std::endl;
+                return 1;
+            }
+        }
+        #ifndef HACKERTYPER_NO_EMBEDDED_PACK
+        else if (!scan && !watch) {
+            openPack(std::string_view(reinterpret_cast<const char*>(embeddedPack), embeddedPackSize), pack);
+        }
+        #endif
+
+        if (pack.count > 0) {
+            // Randomly select a corpus from the pack
+            std::uniform_int_distribution<uint32_t> packDist(0, pack.count - 1);
+            packEntry = packDist(rng);
+            corpusSource.text = pack.text(packEntry);
+        } else {
+            std::vector<std::string> hackerTextFiles = findHackerTextFiles(discoveryCache, verbose);
+
+            // If still no files found, give up
+            if (hackerTextFiles.empty()) {
+                std::cerr << "Error: Cannot find any hackertext files." << std::endl;
+                std::cerr << "Please make sure hackertext.txt exists in one of the search paths." << std::endl;
+                return 1;
+            }
+
+            // Randomly select a file
+            std::uniform_int_distribution<> fileDist(0, hackerTextFiles.size() - 1);
+            std::string selectedFile = hackerTextFiles[fileDist(rng)];
+
+            #ifndef _WIN32
+            if (watch) {
+                // Everything in the selected file's directory, kept up to date by the watcher
+                std::string directory = selectedFile.substr(0, selectedFile.find_last_of('/'));
+                watcher.reset(new CorpusWatcher());
+                if (!watcher->start(directory)) {
+                    if (!watcher->loaded()) {
+                        std::cerr << "Error: no readable hackertext files in " << directory << std::endl;
+                    } else {
+                        std::cerr << "Error: cannot watch " << directory << ": " << strerror(errno) << std::endl;
+                    }
+                    return 1;
+                }
+                watched.reset(new WatchedSource(*watcher));
+                source = watched.get();
+            } else
+            #endif
+            {
+                // Map the randomly selected file; the typing cursor indexes it directly
+                corpus.load(selectedFile);
+                corpusSource.text = corpus.text;
+            }
+
+            // The generator learns from every file, not just the selected one
+            if (generate) {
+                for (const auto& file : hackerTextFiles) {
+                    trainingFiles.emplace_back(new Corpus());
+                    if (trainingFiles.back()->load(file)) {
+                        training.push_back(trainingFiles.back()->text);
+                    }
+                }
+            }
+        }
+
+        if (corpusSource.text.empty() && source == &corpusSource) {
+            std::cerr << "Failed to read text file or file is empty." << std::endl;
+            return 1;
+        }
+
+        if (generate) {
+            for (uint32_t k = 0; k < pack.count; k++) {
+                training.push_back(pack.text(k));
+            }
+            if (!buildMarkovModel(training, markovOrder, model)) {
+                std::cerr << "Error: not enough text to train the generator." << std::endl;
+                return 1;
+            }
+            generator.reset(new GeneratorSource(model, ((uint64_t)rng() << 32) | rng()));
+            source = generator.get();
+        }
+    }
+
+    #ifndef _WIN32
+    // Server mode: no local terminal; every session types from the one corpus
+    if (!serveAddress.empty()) {
+        if (generator || stream) {
+            std::cerr << "Error: --serve types from a corpus or pack, not --generate or --stream." << std::endl;
+            return 1;
+        }
+        Server server;
+        server.text = corpusSource.text;
+        server.watcher = watcher.get();
+        server.charsToAdd = charsToAdd;
+        server.scrollback = scrollbackSet ? scrollback : 0;  // Per-session memory adds up
+        if (!openServer(server, serveAddress)) {
+            std::cerr << "Error: cannot listen on " << serveAddress << ": " << strerror(errno) << std::endl;
+            return 1;
+        }
+        std::cerr << "Serving on " << serveAddress << std::endl;
+        runServer(server);
+        if (ioStats) {
+            reportServerStats(server);
+        }
+        return 0;
+    }
+    #endif
+
+    // Revealed text, bounded to one screenful plus the scrollback
+    int rows, cols;
+    getTerminalSize(rows, cols);
+    if (replaying) {
+        rows = replay.header.rows;
+        cols = replay.header.cols;
+    }
+    ScrollbackRing text;
+    text.resize(rows + scrollback);
+
+    #ifndef _WIN32
+    screenResize(screen, rows, cols);
+    #endif
+    vtResize(headlessScreen, rows, cols);
+
+    // Set up terminal for non-blocking input; a replay leaves it alone
+    if (!replaying) {
+        setupTerminal();
+    }
+
+    // A fast replay runs on virtual time from here on
+    if (replayFast) {
+        loopClock.simulated = true;
+        loopClock.now = std::chrono::steady_clock::now();
+    }
+
+    KeyRecorder recorder;
+    if (!recordPath.empty() && !openRecording(recorder, recordPath, seed, rows, cols)) {
+        std::cerr << "Error: cannot write " << recordPath << std::endl;
+        return 1;
+    }
+    replay.start = loopNow();
+
+    #ifndef _WIN32
+    EventLoop loop;
+    openEventLoop(loop);
+    loop.watchInput = !replaying;
+    if (reportLoopWakeups || stats.enabled) {
+        armTimer(loop, 1000, 1000);
     }
+    AutoType autoType;
+    autoType.cps = autotypeCps;
+    autoType.jitter = autotypeJitter;
+    #endif
 
-    int i = 0;
-    std::string text = "";
+    // The typing view takes over once the intro has played; keys pressed
+    // before then are revealed when it appears
+    bool typingView = false;
+    bool frameDirty = false;
 
-    // Set up terminal for non-blocking input
-    setupTerminal();
+    // Keys arriving between frames only update the model; the screen is
+    // rendered at most once per frame interval
+    std::chrono::steady_clock::duration frameInterval(0);
+    if (fps > 0) {
+        frameInterval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds(1000000000LL / fps));
+    }
 
     // Setup MS-DOS style interface
-    setupMSDOSStyle();
-    
-    // Show prompt with blinking cursor
-    std::cout << "C:\\HACK>";
-    std::cout.flush();
-    
-    // Short delay to simulate system loading
-    sleep_ms(500);
+    SequenceEffect* intro = setupMSDOSStyle();
+
+    // Show prompt with blinking cursor, then a short delay to simulate system loading
+    ScriptEffect* prompt = new ScriptEffect();
+    prompt->add(nullptr, "C:\\HACK>", 500);
+    intro->add(prompt);
+    #ifndef _WIN32
+    // With --panes the typing view shares the screen with two live feeds
+    PaneLayout panes;
+    auto showPanes = [&]() {
+        layoutPanes(panes, rows, cols);
+        selectPane(&panes.typing);
+        redrawTypingView(text, panes.typing.rows, panes.typing.cols);
+    };
+    #endif
+    intro->add(new CallbackEffect([&]() {
+        typingView = true;
+        #ifndef _WIN32
+        if (usePanes) {
+            showPanes();
+            scheduleEffect(effects, new RepeatEffect([&panes]() {
+                ScriptEffect* scan = new ScriptEffect();
+                scan->pane = &panes.scan;
+                simulateIPScan(*scan);
+                return scan;
+            }, 800, 1500));
+            scheduleEffect(effects, new RepeatEffect([&panes]() {
+                ScriptEffect* error = new ScriptEffect();
+                error->pane = &panes.errors;
+                showFakeError(*error);
+                return error;
+            }, 2000, 5000), 1000);
+        }
+        #endif
+        if (!fullRedraw && !usePanes) {
+            redrawTypingView(text, rows, cols);
+        }
+        #ifndef _WIN32
+        if (autoType.cps > 0) {
+            startAutoType(loop, autoType, frameInterval);
+        }
+        #endif
+        frameDirty = true;
+    }));
+    scheduleEffect(effects, intro);
 
     // Main loop - run until user presses Esc (Windows) or Ctrl+C (Linux)
     bool running = true;
     int keyPressCount = 0;
-    std::uniform_int_distribution<> errorDist(1, 100);
+    std::uniform_int_distribution<> errorDist(1, 200);
+
+    auto nextFrame = loopNow();
     
     while (running) {
+        // The next thing due: an effect step, a pending frame or a replayed key batch
+        std::chrono::steady_clock::time_point deadline;
+        bool hasDeadline = nextEffectDue(effects, deadline);
+        if (frameDirty && (!hasDeadline || nextFrame < deadline)) {
+            deadline = nextFrame;
+            hasDeadline = true;
+        }
+        if (replaying && !replay.done() && (!hasDeadline || replay.nextDue() < deadline)) {
+            deadline = replay.nextDue();
+            hasDeadline = true;
+        }
+
+        // A replay ends once its keys are in and everything but the endless
+        // pane feeds has settled
+        if (replaying && replay.done() && effects.active == effects.endless && !frameDirty) {
+            break;
+        }
+
+        // Virtual time never waits: jump straight to the next event
+        if (replayFast && hasDeadline && deadline > loopClock.now) {
+            loopClock.now = deadline;
+        }
+
+        #ifdef _WIN32
         // Check for keyboard input (non-blocking)
-        if (kbhit()) {
-            char c = getch();
-            
-            // Exit if Escape key is pressed (Windows) or Ctrl+C (Linux)
-            #ifdef _WIN32
-            if (c == 27) {
-                running = false;
+        bool keyReady = !replaying && kbhit();
+        #else
+        // Sleep until there is something to do; a fast replay only polls for signals
+        const std::chrono::steady_clock::time_point noWait;
+        waitForEvents(loop, replayFast ? &noWait : hasDeadline ? &deadline : nullptr);
+        bool keyReady = loop.inputReady;
+        if (loop.quitRequested) {
+            running = false;
+        }
+        if (loop.timerFired && reportLoopWakeups) {
+            unsigned long own = loop.wakeups - loop.timerWakeups;
+            showStatus("[ wakeups/s: " + std::to_string(own - lastWakeups) + " ]");
+            lastWakeups = own;
+            frameDirty = true;
+        }
+        if (loop.timerFired && stats.enabled) {
+            // Drawn over the right of the bottom row
+            screen.overlay = statsOverlay(stats);
+            frameDirty = true;
+        }
+        if (loop.paceFired && autoType.running) {
+            // Everything due since the last tick goes out as one batch
+            uint64_t due = autoTypeDue(loop, autoType);
+            if (due > 0) {
+                autoType.revealed += revealForKey(*source, due, text, highlight ? &highlighter : nullptr,
+                                                  !fullRedraw);
+                frameDirty = true;
             }
-            #else
-            if (c == 3) {  // Ctrl+C
+        }
+        #endif
+
+        char keys[4096];
+        size_t count = 0;
+        if (keyReady) {
+            count = readKeys(keys, sizeof(keys));
+            if (stdinClosed) {
                 running = false;
             }
-            #endif
-            else {
-                // Clear screen
-                clearScreen();
-                
-                // Reset text color for DOS-like look
-                setGrayText();
-                
-                // DOS-like header
-                std::cout << "C:\\HACK>DECRYPT.EXE" << std::endl;
-                std::cout << "SCANNING NETWORK..." << std::endl << std::endl;
-                
-                // Add more text when any key is pressed
-                for (int j = 0; j < charsToAdd && i < str.length(); j++, i++) {
-                    text += str[i];
+        }
+        if (replaying) {
+            count = replayKeys(replay, loopNow(), keys, sizeof(keys));
+        }
+
+        if (count > 0) {
+            if (recorder.file.is_open()) {
+                recordKeys(recorder, keys, count);
+            }
+            if (stats.enabled) {
+                statsKeys(stats, count);
+            }
+
+            for (size_t k = 0; k < count && running; k++) {
+                char c = keys[k];
+
+                // Exit if Escape key is pressed (Windows) or Ctrl+C (Linux)
+                #ifdef _WIN32
+                if (c == 27) {
+                    running = false;
+                }
+                #else
+                if (c == 3) {  // Ctrl+C
+                    running = false;
                 }
-                
-                if (i >= str.length()) {
-                    i = 0;
+                #endif
+                else if (c == 12) {  // Ctrl+L
+                    resizePending = 1;
                 }
-                
-                // Occasionally show fake errors (about 5% chance after 10 keypresses)
-                keyPressCount++;
-                if (keyPressCount > 10 && errorDist(gen) <= .5) {
-                    showFakeError();
-                    keyPressCount = 0;
+                else if (c == 14 && pack.count > 1 && !generator) {  // Ctrl+N: next corpus in the pack
+                    packEntry = (packEntry + 1) % pack.count;
+                    corpusSource.text = pack.text(packEntry);
+
+                    // Pick up at a random line so switching back and forth stays fresh
+                    uint32_t lines = pack.lineCount(packEntry);
+                    corpusSource.pos = 0;
+                    if (lines > 0) {
+                        std::uniform_int_distribution<uint32_t> lineDist(0, lines - 1);
+                        uint32_t start = pack.lineStarts(packEntry)[lineDist(rng)];
+                        if (start < corpusSource.text.size()) corpusSource.pos = start;
+                    }
+                    highlighter = Highlighter();
+                }
+                else {
+                    // Add more text when any key is pressed
+                    revealForKey(*source, charsToAdd, text, highlight ? &highlighter : nullptr,
+                                 typingView && !fullRedraw);
+
+                    // Occasionally show fake errors (a 0.5% chance per key after 10 keypresses);
+                    // the error plays out while typing carries on
+                    keyPressCount++;
+                    if (typingView && !usePanes && effects.active == 0 && keyPressCount > 10 && errorDist(rng) <= 1) {
+                        ScriptEffect* error = new ScriptEffect();
+                        showFakeError(*error);
+                        scheduleEffect(effects, error);
+                        keyPressCount = 0;
+                    }
+                    frameDirty = true;
                 }
-                
-                // Display text with proper formatting
-                displayText(text);
-                
-                // Add blinking cursor at the end
+            }
+        }
+
+        if (resizePending) {
+            resizePending = 0;
+            // A replay keeps the recorded size
+            if (!replaying) {
+                getTerminalSize(rows, cols);
+            }
+            text.resize(rows + scrollback);
+            vtResize(headlessScreen, rows, cols);
+            #ifndef _WIN32
+            screenResize(screen, rows, cols);
+            if (typingView && usePanes) {
+                showPanes();
+            }
+            #endif
+            if (typingView && !fullRedraw && !usePanes) {
+                redrawTypingView(text, rows, cols);
+            }
+            frameDirty = true;
+        }
+
+        // Advance running effects; in the typing view they write at the cursor
+        bool effectsOverTyping = typingView && !fullRedraw && !usePanes && effects.active > 0;
+        if (effectsOverTyping) {
+            beginAppend();
+        }
+        if (runEffects(effects, loopNow()) > 0) {
+            frameDirty = true;
+        }
+        if (effectsOverTyping) {
+            endAppend();
+        }
+
+        // Render once for everything that happened since the last frame
+        auto now = loopNow();
+        if (frameDirty && running && now >= nextFrame) {
+            std::chrono::steady_clock::time_point frameStart;
+            if (stats.enabled) {
+                frameStart = std::chrono::steady_clock::now();
+            }
+            if (fullRedraw && typingView) {
+                clearScreen();
+                showTypingHeader();
+                displayText(text, rows - kTypingHeaderRows, cols);
                 setGrayText();
-                std::cout << "_" << std::endl;
-                
-                // Show exit reminder
+                term << "_" << "\n";
+            }
+            #ifndef _WIN32
+            // The terminal cursor rests where typing continues
+            if (typingView && usePanes) {
+                const Pane& typing = panes.typing;
+                screenMove(screen, typing.top + typing.cursorRow,
+                           typing.left + std::min(typing.cursorCol, typing.cols - 1));
+            }
+            #endif
+            presentFrame();
+            if (stats.enabled) {
+                statsFrame(stats, frameStart);
             }
+            frameDirty = false;
+            nextFrame = now + frameInterval;
         }
         
+        #ifdef _WIN32
         // Sleep a bit to prevent high CPU usage
-        sleep_ms(10);
+        if (!replayFast) {
+            sleep_ms(10);
+        }
+        #endif
+    }
+
+    // What a headless run leaves on its screen, before the exit clears it
+    std::string finalScreen;
+    if (headless) {
+        presentFrame();
+        finalScreen = vtText(headlessScreen);
     }
 
     // Reset terminal settings and colors
+    #ifndef _WIN32
+    selectPane(nullptr);
+    screen.overlay.clear();
+    #endif
     resetTextColor();
     clearScreen();
-    resetTerminal();
+    presentFrame();
+    if (!replaying) {
+        resetTerminal();
+    }
+    std::cout << finalScreen << std::flush;
+    recorder.file.close();
+
+    if (ioStats) {
+        reportFrameStats();
+        reportRainStats();
+    }
+    if (stats.enabled) {
+        reportStats(stats);
+    }
+
+    #ifndef _WIN32
+    if (reportLoopWakeups) {
+        reportWakeups(loop);
+    }
+    reportAutoType(autoType);
+    if (watcher && verbose) {
+        std::cerr << "corpus reloads: " << watcher->reloads << std::endl;
+    }
+    if (stream && verbose) {
+        std::cerr << "stream stalls: " << stream->stalls << std::endl;
+    }
+    closeEventLoop(loop);
+    #endif
     
     return 0;
-}
\ No newline at end of file
+}
+#endif